@@ -81,6 +81,7 @@ namespace ClassGame {
                         ImGui::Text("%s", stateString.substr(y*stride,stride).c_str());
                     }
                     ImGui::Text("Current Board State: %s", game->stateString().c_str());
+                    game->drawSettings();
                 }
                 ImGui::End();
 
@@ -95,6 +96,35 @@ namespace ClassGame {
                 ImGui::End();
         }
 
+        //
+        // search benchmark, main() runs this instead of opening a window
+        // when started with "bench [depth]"
+        //
+        int RunBench(int depth)
+        {
+            Chess chess;
+            chess.benchThreads(depth);
+            return 0;
+        }
+
+        //
+        // move generator check, "perft [depth]"
+        //
+        int RunPerft(int depth)
+        {
+            Chess chess;
+            return chess.benchPerft(depth) ? 0 : 1;
+        }
+
+        //
+        // board evaluator check, "evalbench"
+        //
+        int RunEvalBench()
+        {
+            Chess chess;
+            return chess.benchEvaluation() ? 0 : 1;
+        }
+
         //
         // end turn is called by the game code at the end of each turn
         // this is where we check for a winner
@@ -4,4 +4,7 @@ namespace ClassGame {
     void GameStartUp();
     void RenderGame();
     void EndOfTurn();
+    int RunBench(int depth);
+    int RunPerft(int depth);
+    int RunEvalBench();
 }
@@ -0,0 +1,188 @@
+#include "BoardEvaluator.h"
+#include "GameState.h"
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define BOARD_EVALUATOR_X86
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define TARGET_SSE41
+#define TARGET_AVX2
+#else
+#define TARGET_SSE41 __attribute__((target("sse4.1")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+// every evaluator sums the same packed table entries, integer adds in any order give the same bits
+static int evaluateScalar(const char* state)
+{
+    const int* scores = GameState::pieceSquareTable();
+    const int* weights = GameState::phaseWeightTable();
+    int score = 0;
+    int phase = 0;
+    for (int square = 0; square < 64; square++) {
+        const unsigned char piece = state[square] & 0x7F;
+        score += scores[piece * 64 + square];
+        phase += weights[piece];
+    }
+    return GameState::taperScore(score, phase);
+}
+
+#if defined(BOARD_EVALUATOR_X86)
+
+// no gather before AVX2, so four squares at a time are widened into table indexes and the
+// lookups go out through the general registers. a compare against the empty square character
+// marks the occupied squares first, groups of four empty ones score zero and are skipped
+TARGET_SSE41 static int evaluateSSE41(const char* state)
+{
+    const int* scores = GameState::pieceSquareTable();
+    const int* weights = GameState::phaseWeightTable();
+    const __m128i empty = _mm_set1_epi8('0');
+    const __m128i pieceMask = _mm_set1_epi32(0x7F);
+    const __m128i lanes = _mm_setr_epi32(0, 1, 2, 3);
+    uint64_t occupied = 0;
+    for (int chunk = 0; chunk < 64; chunk += 16) {
+        const __m128i squares = _mm_loadu_si128(reinterpret_cast<const __m128i*>(state + chunk));
+        const unsigned int emptyMask = static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(squares, empty)));
+        occupied |= static_cast<uint64_t>(~emptyMask & 0xFFFF) << chunk;
+    }
+    __m128i scoreSum = _mm_setzero_si128();
+    __m128i phaseSum = _mm_setzero_si128();
+    for (int square = 0; square < 64; square += 4) {
+        if (!((occupied >> square) & 0xF)) {
+            continue;
+        }
+        int group;
+        std::memcpy(&group, state + square, sizeof(group));
+        const __m128i pieces = _mm_and_si128(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(group)), pieceMask);
+        const __m128i indexes = _mm_add_epi32(_mm_slli_epi32(pieces, 6), _mm_add_epi32(_mm_set1_epi32(square), lanes));
+        __m128i score = _mm_cvtsi32_si128(scores[_mm_cvtsi128_si32(indexes)]);
+        score = _mm_insert_epi32(score, scores[_mm_extract_epi32(indexes, 1)], 1);
+        score = _mm_insert_epi32(score, scores[_mm_extract_epi32(indexes, 2)], 2);
+        score = _mm_insert_epi32(score, scores[_mm_extract_epi32(indexes, 3)], 3);
+        __m128i phase = _mm_cvtsi32_si128(weights[_mm_cvtsi128_si32(pieces)]);
+        phase = _mm_insert_epi32(phase, weights[_mm_extract_epi32(pieces, 1)], 1);
+        phase = _mm_insert_epi32(phase, weights[_mm_extract_epi32(pieces, 2)], 2);
+        phase = _mm_insert_epi32(phase, weights[_mm_extract_epi32(pieces, 3)], 3);
+        scoreSum = _mm_add_epi32(scoreSum, score);
+        phaseSum = _mm_add_epi32(phaseSum, phase);
+    }
+    scoreSum = _mm_add_epi32(scoreSum, _mm_shuffle_epi32(scoreSum, _MM_SHUFFLE(1, 0, 3, 2)));
+    scoreSum = _mm_add_epi32(scoreSum, _mm_shuffle_epi32(scoreSum, _MM_SHUFFLE(2, 3, 0, 1)));
+    phaseSum = _mm_add_epi32(phaseSum, _mm_shuffle_epi32(phaseSum, _MM_SHUFFLE(1, 0, 3, 2)));
+    phaseSum = _mm_add_epi32(phaseSum, _mm_shuffle_epi32(phaseSum, _MM_SHUFFLE(2, 3, 0, 1)));
+    return GameState::taperScore(_mm_cvtsi128_si32(scoreSum), _mm_cvtsi128_si32(phaseSum));
+}
+
+// 32 squares per load, widened eight at a time into table indexes piece * 64 + square
+// and gathered straight from the score and phase tables
+TARGET_AVX2 static int evaluateAVX2(const char* state)
+{
+    const int* scores = GameState::pieceSquareTable();
+    const int* weights = GameState::phaseWeightTable();
+    const __m256i pieceMask = _mm256_set1_epi32(0x7F);
+    __m256i scoreSum = _mm256_setzero_si256();
+    __m256i phaseSum = _mm256_setzero_si256();
+    __m256i squares = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i eight = _mm256_set1_epi32(8);
+    for (int half = 0; half < 64; half += 32) {
+        const __m256i board = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(state + half));
+        const __m128i low = _mm256_castsi256_si128(board);
+        const __m128i high = _mm256_extracti128_si256(board, 1);
+        const __m128i groups[4] = { low, _mm_srli_si128(low, 8), high, _mm_srli_si128(high, 8) };
+        for (const __m128i& group : groups) {
+            const __m256i pieces = _mm256_and_si256(_mm256_cvtepu8_epi32(group), pieceMask);
+            const __m256i indexes = _mm256_add_epi32(_mm256_slli_epi32(pieces, 6), squares);
+            scoreSum = _mm256_add_epi32(scoreSum, _mm256_i32gather_epi32(scores, indexes, 4));
+            phaseSum = _mm256_add_epi32(phaseSum, _mm256_i32gather_epi32(weights, pieces, 4));
+            squares = _mm256_add_epi32(squares, eight);
+        }
+    }
+    __m128i score = _mm_add_epi32(_mm256_castsi256_si128(scoreSum), _mm256_extracti128_si256(scoreSum, 1));
+    __m128i phase = _mm_add_epi32(_mm256_castsi256_si128(phaseSum), _mm256_extracti128_si256(phaseSum, 1));
+    score = _mm_add_epi32(score, _mm_shuffle_epi32(score, _MM_SHUFFLE(1, 0, 3, 2)));
+    score = _mm_add_epi32(score, _mm_shuffle_epi32(score, _MM_SHUFFLE(2, 3, 0, 1)));
+    phase = _mm_add_epi32(phase, _mm_shuffle_epi32(phase, _MM_SHUFFLE(1, 0, 3, 2)));
+    phase = _mm_add_epi32(phase, _mm_shuffle_epi32(phase, _MM_SHUFFLE(2, 3, 0, 1)));
+    return GameState::taperScore(_mm_cvtsi128_si32(score), _mm_cvtsi128_si32(phase));
+}
+
+static bool cpuHas(BoardEvaluator::Implementation implementation)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    const int highestLeaf = info[0];
+    __cpuid(info, 1);
+    if (implementation == BoardEvaluator::SSE41) {
+        return (info[2] & (1 << 19)) != 0;
+    }
+    // AVX2 also needs the OS to save the ymm registers
+    const bool osAvx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+    if (!osAvx || highestLeaf < 7) {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return implementation == BoardEvaluator::SSE41 ? __builtin_cpu_supports("sse4.1") : __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif
+
+bool BoardEvaluator::isSupported(Implementation implementation)
+{
+    if (implementation == Scalar) {
+        return true;
+    }
+#if defined(BOARD_EVALUATOR_X86)
+    return cpuHas(implementation);
+#else
+    return false;
+#endif
+}
+
+const char* BoardEvaluator::name(Implementation implementation)
+{
+    switch (implementation) {
+        case SSE41: return "sse4.1";
+        case AVX2: return "avx2";
+        default: return "scalar";
+    }
+}
+
+BoardEvaluator::EvaluateFunction BoardEvaluator::select(Implementation implementation)
+{
+#if defined(BOARD_EVALUATOR_X86)
+    if (implementation == AVX2 && isSupported(AVX2)) {
+        return evaluateAVX2;
+    }
+    if (implementation == SSE41 && isSupported(SSE41)) {
+        return evaluateSSE41;
+    }
+#endif
+    return evaluateScalar;
+}
+
+int BoardEvaluator::evaluate(const char* state, Implementation implementation)
+{
+    return select(implementation)(state);
+}
+
+static BoardEvaluator::Implementation bestImplementation()
+{
+    if (BoardEvaluator::isSupported(BoardEvaluator::AVX2)) {
+        return BoardEvaluator::AVX2;
+    }
+    if (BoardEvaluator::isSupported(BoardEvaluator::SSE41)) {
+        return BoardEvaluator::SSE41;
+    }
+    return BoardEvaluator::Scalar;
+}
+
+const BoardEvaluator::Implementation BoardEvaluator::_implementation = bestImplementation();
+const BoardEvaluator::EvaluateFunction BoardEvaluator::_evaluate = BoardEvaluator::select(BoardEvaluator::_implementation);
@@ -0,0 +1,31 @@
+#pragma once
+
+// full board evaluation from the 64 state characters alone, for positions that don't come
+// out of pushMove (GUI turns, position files, batch analysis). vectorized where the cpu
+// allows, picked once at runtime, and always the same result as Chess::evaluateBoard.
+// needs GameState::init to have run once so the score tables exist
+class BoardEvaluator
+{
+public:
+    enum Implementation {
+        Scalar,
+        SSE41,
+        AVX2
+    };
+
+    // material and piece squares from white's side, state is the usual 64 ascii squares
+    static int evaluate(const char* state) { return _evaluate(state); }
+    static int evaluate(const char* state, Implementation implementation);
+
+    // the best one this cpu runs, and whether a given one runs at all
+    static Implementation implementation() { return _implementation; }
+    static bool isSupported(Implementation implementation);
+    static const char* name(Implementation implementation);
+
+private:
+    using EvaluateFunction = int (*)(const char* state);
+    static EvaluateFunction select(Implementation implementation);
+
+    static const Implementation _implementation;
+    static const EvaluateFunction _evaluate;
+};
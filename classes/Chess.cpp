@@ -1,13 +1,18 @@
 #include "Chess.h"
 #include "Logger.h"
-#include "PieceSquare.h"
+#include "MovePicker.h"
+#include "BoardEvaluator.h"
 #include <limits>
 #include <cmath>
 #include <string>
 #include <sstream> // Required for std::stringstream
 #include <vector>
 #include <chrono>
+#include <functional>
 #include <iomanip>
+#include <algorithm>
+#include <random>
+#include <optional>
 
 Chess::Chess()
 {
@@ -16,6 +21,7 @@ Chess::Chess()
 
 Chess::~Chess()
 {
+    stopSearch();
     delete _grid;
 }
 
@@ -52,9 +58,12 @@ void Chess::setUpBoard()
     _gameOptions.rowX = 8;
     _gameOptions.rowY = 8;
     _gameOptions.AIMAXDepth = 5;
+    _gameOptions.AIMaxTimeMs = 5000;
+    _gameOptions.AIMaxNodes = 0;
 
     _grid->initializeChessSquares(pieceSize, "boardsquare.png");
     _highlights.reserve(32);
+    initSearch();
 
     FENtoBoard("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR");
     GenKnightBoards();
@@ -62,19 +71,6 @@ void Chess::setUpBoard()
     //GenAllMoves(_moves, stateString(), getCurrentPlayer()->playerNumber() * 128 == 0 ? 1 : -1);
     gs.init(stateString().c_str(), 1);
     _moves = gs.generateAllMoves();
-
-    memcpy(_pieceSquares['p'], pawnTable, 64);
-    memcpy(_pieceSquares['P'], pawnTable, 64);
-    memcpy(_pieceSquares['r'], rookTable, 64);
-    memcpy(_pieceSquares['R'], rookTable, 64);
-    memcpy(_pieceSquares['b'], bishopTable, 64);
-    memcpy(_pieceSquares['B'], bishopTable, 64);
-    memcpy(_pieceSquares['n'], knightTable, 64);
-    memcpy(_pieceSquares['N'], knightTable, 64);
-    memcpy(_pieceSquares['q'], queenTable, 64);
-    memcpy(_pieceSquares['Q'], queenTable, 64);
-    memcpy(_pieceSquares['k'], kingTable, 64);
-    memcpy(_pieceSquares['K'], kingTable, 64);
     startGame();
 
     if (gameHasAI()) {
@@ -82,6 +78,27 @@ void Chess::setUpBoard()
     }
 }
 
+// everything the search needs that doesn't depend on the board on screen
+void Chess::initSearch()
+{
+    _tt.resize(transpositionTableMB);
+    _evalCache.resize(evalCacheMB);
+    _evalCacheNetwork = nullptr;
+    _threads.clear();
+    _threads.push_back(std::make_unique<SearchThread>());
+    _resultPvLength = 0;
+    // late move reductions grow with both the remaining depth and how late the move is ordered
+    for (int depth = 0; depth <= MAX_DEPTH; depth++) {
+        for (int moveNumber = 0; moveNumber < 64; moveNumber++) {
+            _lmrReductions[depth][moveNumber] = (depth == 0 || moveNumber == 0) ? 0 :
+                static_cast<int>(0.75 + std::log(depth) * std::log(moveNumber) / 2.25);
+        }
+    }
+    if (!_network.loaded() && _network.load(networkFile)) {
+        std::cout << "loaded " << networkFile << std::endl;
+    }
+}
+
 void Chess::FENtoBoard(const std::string& fen) {
     // convert a FEN string to a board
     // FEN is a space delimited string with 6 fields
@@ -215,6 +232,21 @@ void Chess::endTurn() {
     _moves = gs.generateAllMoves();
 }
 
+void Chess::bitMovedFromTo(Bit &bit, BitHolder &src, BitHolder &dst)
+{
+    // pawns reaching the last rank become queens, same as GameState::pushMove
+    ChessSquare& dstSquare = static_cast<ChessSquare&>(dst);
+    if ((bit.gameTag() & 127) == Pawn && (dstSquare.getRow() == 0 || dstSquare.getRow() == 7)) {
+        int playerNumber = bit.gameTag() < 128 ? 0 : 1;
+        Bit* queen = PieceForPlayer(playerNumber, Queen);
+        queen->setPosition(dst.getPosition());
+        queen->setGameTag(Queen + (playerNumber == 0 ? 0 : 128));
+        dst.destroyBit();
+        dst.setBit(queen);
+    }
+    Game::bitMovedFromTo(bit, src, dst);
+}
+
 bool Chess::canBitMoveFrom(Bit &bit, BitHolder &src)
 {
     // remove highlights
@@ -262,12 +294,63 @@ bool Chess::canBitMoveFromTo(Bit &bit, BitHolder &src, BitHolder &dst)
 
 void Chess::stopGame()
 {
+    stopSearch();
     _grid->forEachSquare([](ChessSquare* square, int x, int y) {
         square->destroyBit();
     });
     gs.shutdown();
 }
 
+void Chess::drawSettings()
+{
+    bool nullMove = _useNullMove;
+    if (ImGui::Checkbox("Null move pruning", &nullMove)) {
+        _useNullMove = nullMove;
+    }
+    bool lateMoveReductions = _useLateMoveReductions;
+    if (ImGui::Checkbox("Late move reductions", &lateMoveReductions)) {
+        _useLateMoveReductions = lateMoveReductions;
+    }
+    bool forwardPruning = _useForwardPruning;
+    if (ImGui::Checkbox("Futility pruning and razoring", &forwardPruning)) {
+        _useForwardPruning = forwardPruning;
+    }
+    int threads = _searchThreads;
+    if (ImGui::SliderInt("Search threads", &threads, 1, maxSearchThreads)) {
+        _searchThreads = threads;
+    }
+    int parallelMode = _parallelMode;
+    ImGui::RadioButton("Lazy SMP", &parallelMode, LazySMP);
+    ImGui::SameLine();
+    ImGui::RadioButton("Young brothers wait", &parallelMode, YoungBrothersWait);
+    _parallelMode = parallelMode;
+    bool pondering = _usePondering;
+    if (ImGui::Checkbox("Ponder on the human's turn", &pondering)) {
+        _usePondering = pondering;
+        if (!pondering && _pondering) {
+            stopSearch();
+        }
+    }
+    if (_network.loaded()) {
+        bool useNetwork = _useNetwork;
+        if (ImGui::Checkbox("Network evaluation", &useNetwork)) {
+            _useNetwork = useNetwork;
+        }
+    }
+
+    // whatever the worker published last, never waits on it
+    _progress.update();
+    const SearchProgress& progress = _progress.front();
+    if (progress.depth > 0) {
+        std::string pv;
+        for (int i = 0; i < progress.pvLength; i++) {
+            pv += moveNotation(progress.pv[i]) + " ";
+        }
+        ImGui::Text("AI %s depth %d score %d nodes %lld", _pondering ? "pondering" : "searching", progress.depth, progress.score, progress.nodes);
+        ImGui::TextWrapped("PV: %s", pv.c_str());
+    }
+}
+
 Player* Chess::ownerAt(int x, int y) const
 {
     if (x < 0 || x >= 8 || y < 0 || y >= 8) {
@@ -320,97 +403,1294 @@ void Chess::setStateString(const std::string &s)
 }
 
 
-static std::map<char, int> evaluateScores = {
-    {'P', 100}, {'p', -100},    // Pawns
-    {'N', 200}, {'n', -200},    // Knights
-    {'B', 230}, {'b', -230},    // Bishops
-    {'R', 400}, {'r', -400},    // Rooks
-    {'Q', 900}, {'q', -900},    // Queens
-    {'K', 2000}, {'k', -2000},  // Kings
-    {'0', 0}                     // Empty squares
-};
-
+// full scan of the 64 squares, the search uses GameState::evaluate() which pushMove keeps
+// up to date, plus the pawn structure. both give the same material and piece square score
 int Chess::evaluateBoard(const std::string& state) {
-    int value = 0;
-    int index = 0;
-    for(char ch : state) {
-        value += evaluateScores[ch];
-        value += _pieceSquares[ch][index];
-        index++;
+    int score = 0;
+    int phase = 0;
+    for (size_t square = 0; square < 64 && square < state.size(); square++) {
+        const unsigned char piece = state[square] & 0x7F;
+        score += GameState::pieceSquareScore(piece, static_cast<int>(square));
+        phase += GameState::phaseWeight(piece);
     }
-    return value;
+    return GameState::taperScore(score, phase);
 }
 
 void Chess::updateAI()
+{
+    // the worker may still be pondering on the reply we predicted for the human
+    if (_searchThread.joinable() && _pondering) {
+        if (stateString() == _ponderState) {
+            // ponder hit, the search keeps going and the budget starts counting now
+            std::cout << "ponder hit" << std::endl;
+            _searchStartTicks = std::chrono::steady_clock::now().time_since_epoch().count();
+            _pondering = false;
+        } else {
+            // ponder miss, whatever it stored in the transposition table is still useful
+            stopSearch();
+        }
+    }
+
+    // the search runs on a worker thread, this gets polled every frame until it has a move
+    if (!_searchThread.joinable()) {
+        startSearch();
+        return;
+    }
+    if (!_searchFinished.load(std::memory_order_acquire)) {
+        return;
+    }
+    _searchThread.join();
+    applyMove(_searchResult);
+}
+
+// snapshot the position and hand it to the worker, everything the search touches
+// from here on belongs to that thread until _searchFinished is set
+void Chess::startSearch()
+{
+    if (_moves.empty()) {
+        return;
+    }
+    const int rootColor = getCurrentPlayer()->playerNumber() == 0 ? WHITE : BLACK;
+    GameState rootState;
+    rootState.init(stateString().c_str(), rootColor);
+    loadGameHistory(rootState);
+    launchSearch(rootState, _moves, rootColor, false);
+}
+
+// keep searching on the human's time, assuming they play the reply from our last PV
+void Chess::startPonder()
+{
+    if (!_usePondering || _gameOptions.AIvsAI || getCurrentPlayer()->isAIPlayer() || _resultPvLength < 2) {
+        return;
+    }
+    const BitMove predicted = _resultPv[1];
+    if (std::find(_moves.begin(), _moves.end(), predicted) == _moves.end()) {
+        return;
+    }
+    GameState afterPredicted = gs;
+    afterPredicted.pushMove(predicted);
+    const int aiColor = afterPredicted.color;
+    GameState rootState;
+    rootState.init(afterPredicted.state, aiColor);
+    std::vector<BitMove> rootMoves = rootState.generateAllMoves();
+    if (rootMoves.empty()) {
+        return;
+    }
+    loadGameHistory(rootState);
+    _ponderState.assign(rootState.state, 64);
+    std::cout << "pondering on " << moveNotation(predicted) << std::endl;
+    launchSearch(rootState, rootMoves, aiColor, true);
+}
+
+void Chess::loadGameHistory(GameState& rootState) const
+{
+    std::vector<uint64_t> keys;
+    const char* later = rootState.state;
+    char color = rootState.color;
+    for (auto it = _turns.rbegin(); it != _turns.rend(); ++it) {
+        const std::string& board = (*it)->_boardState;
+        // the last turn is usually the root itself
+        if (board.size() < 64 || std::memcmp(board.data(), later, 64) == 0) {
+            continue;
+        }
+        // a capture changes the piece count, a pawn move the pawns. nothing before either can repeat
+        int pieces = 0;
+        bool pawnMoved = false;
+        for (int square = 0; square < 64; square++) {
+            pieces += (board[square] != '0') - (later[square] != '0');
+            const bool pawnBefore = board[square] == 'P' || board[square] == 'p';
+            const bool pawnAfter = later[square] == 'P' || later[square] == 'p';
+            pawnMoved |= (pawnBefore || pawnAfter) && board[square] != later[square];
+        }
+        if (pieces != 0 || pawnMoved) {
+            break;
+        }
+        color = color == WHITE ? BLACK : WHITE;
+        GameState position;
+        position.init(board.c_str(), color);
+        keys.push_back(position.hash());
+        later = board.data();
+    }
+    std::reverse(keys.begin(), keys.end());
+    rootState.setHistory(keys);
+}
+
+void Chess::launchSearch(const GameState& rootState, const std::vector<BitMove>& rootMoves, int rootColor, bool ponder)
+{
+    _progress.back() = SearchProgress();
+    _progress.publish();
+    _stopRequested = false;
+    _searchFinished = false;
+    _pondering = ponder;
+    _searchStartTicks = std::chrono::steady_clock::now().time_since_epoch().count();
+    _searchThread = std::thread(&Chess::searchWorker, this, rootState, rootMoves, rootColor);
+}
+
+void Chess::stopSearch()
+{
+    if (_searchThread.joinable()) {
+        _stopRequested = true;
+        _searchThread.join();
+    }
+    _pondering = false;
+}
+
+void Chess::searchWorker(GameState rootState, std::vector<BitMove> rootMoves, int rootColor)
+{
+    _searchResult = runSearch(rootState, rootMoves, rootColor);
+    _searchFinished.store(true, std::memory_order_release);
+}
+
+// milliseconds since the search started, or since the ponder hit
+long long Chess::searchElapsedMs() const
+{
+    const auto start = std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(_searchStartTicks.load(std::memory_order_relaxed)));
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+// lazy SMP, every thread runs its own iterative deepening from the same root and they only
+// talk through the transposition table. the helpers fill it with results the main thread
+// picks up as cutoffs and move ordering
+BitMove Chess::runSearch(const GameState& rootState, const std::vector<BitMove>& rootMoves, int rootColor)
 {
     const auto searchStart = std::chrono::steady_clock::now();
+    const size_t threadCount = std::clamp(_searchThreads.load(), 1, maxSearchThreads);
+    while (_threads.size() < threadCount) {
+        _threads.push_back(std::make_unique<SearchThread>());
+        _threads.back()->id = static_cast<int>(_threads.size()) - 1;
+    }
+    _threads.resize(threadCount);
+
+    _tt.newSearch();
+    _totalNodes = 0;
+    _budgetNodeBase = 0;
+    _helpersStop = false;
+    _workPool.resize(threadCount);
+    const bool splitting = _parallelMode == YoungBrothersWait;
+    const Nnue* network = _useNetwork && _network.loaded() ? &_network : nullptr;
+    if (network != _evalCacheNetwork) {
+        _evalCache.clear();
+        _evalCacheNetwork = network;
+    }
+    for (auto& thread : _threads) {
+        thread->position = rootState;
+        thread->position.setNetwork(network);
+        thread->rootMoves = rootMoves;
+    }
+    for (size_t i = 1; i < _threads.size(); i++) {
+        if (splitting) {
+            _threads[i]->thread = std::thread(&Chess::splitPointWorker, this, std::ref(*_threads[i]));
+        } else {
+            _threads[i]->thread = std::thread(&Chess::iterativeDeepening, this, std::ref(*_threads[i]), rootColor);
+        }
+    }
+    iterativeDeepening(*_threads[0], rootColor);
+    _helpersStop = true;
+    for (size_t i = 1; i < _threads.size(); i++) {
+        _threads[i]->thread.join();
+    }
+
+    // a helper that finished a deeper iteration than the main thread knows more
+    const SearchThread* best = _threads[0].get();
+    long long nodes = 0;
+    long long quiescenceNodes = 0;
+    long long pawnProbes = 0;
+    long long pawnHits = 0;
+    EvalCacheStats evalCacheStats;
+    PruningStats pruningStats;
+    for (const auto& thread : _threads) {
+        if (thread->completedDepth > best->completedDepth) {
+            best = thread.get();
+        }
+        nodes += thread->countMoves;
+        quiescenceNodes += thread->countQuiescence;
+        pawnProbes += thread->pawnTable.probes();
+        pawnHits += thread->pawnTable.hits();
+        evalCacheStats.hits += thread->evalCacheStats.hits;
+        evalCacheStats.misses += thread->evalCacheStats.misses;
+        evalCacheStats.collisions += thread->evalCacheStats.collisions;
+        pruningStats.reverseFutility += thread->pruningStats.reverseFutility;
+        pruningStats.futility += thread->pruningStats.futility;
+        pruningStats.razoring += thread->pruningStats.razoring;
+    }
+    std::copy(best->prevPv, best->prevPv + best->prevPvLength, _resultPv);
+    _resultPvLength = best->prevPvLength;
+
+    std::cout << best->bestScore << std::endl;
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - searchStart).count();
+    const double boardsPerSecond = seconds > 0.0 ? static_cast<double>(nodes) / seconds : 0.0;
+    std::cout << "Moves checked: " << nodes << " (quiescence " << quiescenceNodes << ")"
+                << " (" << std::fixed << std::setprecision(2) << boardsPerSecond
+                << " boards/s) depth " << best->completedDepth << (_threads[0]->aborted ? " (aborted)" : "")
+                << " threads " << threadCount << (splitting ? " ybwc" : "")
+                << " hashfull " << _tt.hashfull()
+                << " pawn hits " << (pawnProbes ? 100.0 * pawnHits / pawnProbes : 0.0) << "%"
+                << std::defaultfloat << std::endl;
+    std::cout << "eval cache hits " << evalCacheStats.hits << " misses " << evalCacheStats.misses
+              << " collisions " << evalCacheStats.collisions << std::endl;
+    std::cout << "pruned by reverse futility " << pruningStats.reverseFutility << " futility " << pruningStats.futility
+              << " razoring " << pruningStats.razoring << std::endl;
+    _lastSearchNodes = nodes;
+    _lastSearchPruning = pruningStats;
+    return best->bestMove;
+}
+
+// helpers skip some iterations so they aren't all searching the same depth as the main thread,
+// helper n follows row (n - 1) % 20: depths where (depth + phase) / size is odd are skipped
+static const int skipSize[20] = { 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 4, 4, 4, 4, 4, 4, 4, 4 };
+static const int skipPhase[20] = { 0, 1, 0, 1, 2, 3, 0, 1, 2, 3, 4, 5, 0, 1, 2, 3, 4, 5, 6, 7 };
+
+void Chess::resetSearchThread(SearchThread& thread)
+{
+    thread.aborted = false;
+    thread.splitPoint = nullptr;
+    ageHistory(thread);
+    for (auto& killers : thread.killerMoves) {
+        killers[0] = BitMove();
+        killers[1] = BitMove();
+    }
+    thread.countMoves = 0;
+    thread.countQuiescence = 0;
+    thread.pawnTable.resetStats();
+    thread.evalCacheStats = EvalCacheStats();
+    thread.pruningStats = PruningStats();
+    thread.prevPvLength = 0;
+    thread.completedDepth = 0;
+}
+
+void Chess::iterativeDeepening(SearchThread& thread, int rootColor)
+{
+    const bool mainThread = thread.id == 0;
+    resetSearchThread(thread);
+
+    // the root moves get reordered so the best move of the last iteration is searched first
+    thread.bestMove = thread.rootMoves[0];
+    thread.bestScore = negInfinite;
+
+    // iterative deepening, each iteration is a full search to that depth
+    // if the budget runs out mid iteration the result of the last finished one is kept
+    for (int depth = 1; depth <= _gameOptions.AIMAXDepth; depth++) {
+        if (!mainThread) {
+            const int row = (thread.id - 1) % 20;
+            if (((depth + skipPhase[row]) / skipSize[row]) % 2) {
+                continue;
+            }
+        }
+        // aspiration window around the last score, widened until the result lands inside it
+        int delta = aspirationWindow;
+        int alpha = negInfinite;
+        int beta = posInfinite;
+        if (depth >= 3 && thread.completedDepth > 0) {
+            alpha = std::max(thread.bestScore - delta, negInfinite);
+            beta = std::min(thread.bestScore + delta, posInfinite);
+        }
+        int iterationVal;
+        while (true) {
+            iterationVal = searchRoot(thread, depth, alpha, beta, rootColor);
+            if (thread.aborted) {
+                break;
+            }
+            delta *= 2;
+            if (iterationVal <= alpha && alpha > negInfinite) {
+                alpha = std::max(iterationVal - delta, negInfinite);
+            } else if (iterationVal >= beta && beta < posInfinite) {
+                beta = std::min(iterationVal + delta, posInfinite);
+            } else {
+                break;
+            }
+        }
+
+        if (thread.aborted) {
+            break;
+        }
+
+        thread.bestMove = thread.pvTable[0][0];
+        thread.bestScore = iterationVal;
+        thread.completedDepth = depth;
+        auto bestIt = std::find(thread.rootMoves.begin(), thread.rootMoves.end(), thread.bestMove);
+        if (bestIt != thread.rootMoves.end()) {
+            std::rotate(thread.rootMoves.begin(), bestIt, bestIt + 1);
+        }
+        savePrincipalVariation(thread);
+
+        // only the main thread reports and decides when to stop
+        if (!mainThread) {
+            continue;
+        }
+        // helpers' nodes arrive in batches, the main thread's own remainder is added here
+        const long long nodes = _totalNodes.load(std::memory_order_relaxed) + (thread.countMoves & 2047);
+        const auto elapsedMs = searchElapsedMs();
+        std::cout << "depth " << depth << " score " << thread.bestScore << " nodes " << nodes << " time " << elapsedMs << "ms pv";
+        for (int i = 0; i < thread.prevPvLength; i++) {
+            std::cout << " " << moveNotation(thread.prevPv[i]);
+        }
+        std::cout << std::endl;
+
+        SearchProgress& progress = _progress.back();
+        progress.depth = depth;
+        progress.score = thread.bestScore * rootColor;
+        progress.nodes = nodes;
+        progress.pvLength = thread.prevPvLength;
+        std::copy(thread.prevPv, thread.prevPv + thread.prevPvLength, progress.pv);
+        _progress.publish();
+
+        // the next iteration will take several times longer than this one, don't start what can't finish
+        if (!_pondering && _gameOptions.AIMaxTimeMs > 0 && elapsedMs * 2 > _gameOptions.AIMaxTimeMs) {
+            break;
+        }
+    }
+}
+
+// positions for benchThreads in the stateString layout, a1 first
+static const struct {
+    const char* state;
+    int color;
+} benchPositions[] = {
+    { "RNBQKBNRPPPPPPPP00000000000000000000000000000000pppppppprnbqkbnr", WHITE },
+    { "R000K00RPPPBBPPP00N00Q0p0p00P000000PN000bn00pnp0p0ppqpb0r000k00r", WHITE },
+    { "RNBQK00RPPPP0PPP00000N0000B0P0000000p00000n00n00pppp0pppr0bqkb0r", WHITE },
+    { "R00QKB0RPP000PPP00N0PN0000PP0000000p000000n0pn00pp00bpppr0bq0rk0", WHITE },
+    { "0000RRK0P00B00PP00P000N000PP000000p0pb00000q00pQpp0n000p0000rrk0", BLACK },
+    { "00000000000000000000000000P0K0000P0P00000p0p0000k0p0000000000000", WHITE },
+    { "000r000000000PKP000000P0000R000000000000000000p000000p0p000000k0", WHITE },
+};
+
+void Chess::benchThreads(int depth)
+{
+    initSearch();
+    const GameOptions savedOptions = _gameOptions;
+    const int savedThreads = _searchThreads;
+    const int savedMode = _parallelMode;
+    const bool savedPruning = _useForwardPruning;
+    _gameOptions.AIMAXDepth = std::clamp(depth, 1, MAX_DEPTH);
+    _gameOptions.AIMaxTimeMs = 0;
+    _gameOptions.AIMaxNodes = 0;
+    _stopRequested = false;
+    _pondering = false;
+
+    struct BenchResult {
+        int mode;
+        int threads;
+        bool forwardPruning;
+        long long ms;
+        long long nodes;
+        PruningStats pruning;
+    };
+    std::vector<BenchResult> results;
+    // every thread count in both modes, then one thread again without futility and razoring
+    std::vector<BenchResult> runs;
+    for (int mode : { LazySMP, YoungBrothersWait }) {
+        for (int threads : { 1, 2, 4, 8, 16 }) {
+            runs.push_back({ mode, threads, true, 0, 0, PruningStats() });
+        }
+    }
+    runs.push_back({ LazySMP, 1, false, 0, 0, PruningStats() });
+    for (BenchResult result : runs) {
+        _parallelMode = result.mode;
+        _searchThreads = result.threads;
+        _useForwardPruning = result.forwardPruning;
+        for (const auto& position : benchPositions) {
+            // every run starts cold so thread counts are compared fairly
+            _tt.clear();
+            _threads.clear();
+            GameState rootState;
+            rootState.init(position.state, position.color);
+            std::vector<BitMove> rootMoves = rootState.generateAllMoves();
+            const auto start = std::chrono::steady_clock::now();
+            _searchStartTicks = start.time_since_epoch().count();
+            runSearch(rootState, rootMoves, position.color);
+            result.ms += std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+            result.nodes += _lastSearchNodes;
+            result.pruning.reverseFutility += _lastSearchPruning.reverseFutility;
+            result.pruning.futility += _lastSearchPruning.futility;
+            result.pruning.razoring += _lastSearchPruning.razoring;
+        }
+        results.push_back(result);
+    }
+
+    std::cout << "time to depth " << _gameOptions.AIMAXDepth << " over " << std::size(benchPositions) << " positions" << std::endl;
+    for (const BenchResult& result : results) {
+        // both modes are the same search with one thread, speedups are against the first run
+        const double speedup = result.ms > 0 ? static_cast<double>(results[0].ms) / result.ms : 0.0;
+        const long long nodesPerSecond = result.ms > 0 ? result.nodes * 1000 / result.ms : 0;
+        std::cout << (result.mode == LazySMP ? "lazy smp" : "ybwc    ")
+                  << " threads " << std::setw(2) << result.threads
+                  << " time " << std::setw(7) << result.ms << "ms"
+                  << " nodes " << std::setw(10) << result.nodes
+                  << " nps " << std::setw(9) << nodesPerSecond
+                  << " speedup " << std::fixed << std::setprecision(2) << speedup << std::defaultfloat
+                  << (result.forwardPruning ? "" : " no futility/razoring")
+                  << " rfp " << result.pruning.reverseFutility << " futility " << result.pruning.futility
+                  << " razor " << result.pruning.razoring << std::endl;
+    }
+
+    _gameOptions = savedOptions;
+    _searchThreads = savedThreads;
+    _parallelMode = savedMode;
+    _useForwardPruning = savedPruning;
+    _threads.clear();
+    _threads.push_back(std::make_unique<SearchThread>());
+}
+
+bool Chess::benchPerft(int depth)
+{
+    depth = std::clamp(depth, 1, MAX_DEPTH);
+    bool same = true;
+    long long legalMs = 0;
+    long long filterMs = 0;
+    for (const auto& position : benchPositions) {
+        GameState state;
+        state.init(position.state, position.color);
+        if (!state.verifyLegalMoves(std::min(depth, 3))) {
+            same = false;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        const uint64_t legalNodes = state.perft(depth);
+        auto end = std::chrono::steady_clock::now();
+        legalMs += std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+        start = end;
+        const uint64_t filterNodes = state.perft(depth, true);
+        end = std::chrono::steady_clock::now();
+        filterMs += std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+
+        std::cout << position.state << " perft " << depth << " " << legalNodes;
+        if (legalNodes != filterNodes) {
+            std::cout << " filter says " << filterNodes;
+            same = false;
+        }
+        std::cout << std::endl;
+    }
+    std::cout << "legal generator " << legalMs << "ms, filtered " << filterMs << "ms"
+              << (same ? "" : ", generators differ") << std::endl;
+    return same;
+}
+
+bool Chess::benchEvaluation()
+{
+    struct Position {
+        char state[64];
+        int score;
+    };
+    std::vector<Position> positions;
+    std::function<void(GameState&, int)> collect = [&](GameState& state, int depth) {
+        Position position;
+        std::memcpy(position.state, state.state, 64);
+        position.score = state.evaluate();
+        positions.push_back(position);
+        if (depth == 0) {
+            return;
+        }
+        MoveList moves;
+        state.generateAllMoves(moves);
+        for (const BitMove& move : moves) {
+            state.pushMove(move);
+            collect(state, depth - 1);
+            state.popState();
+        }
+    };
+    for (const auto& benchPosition : benchPositions) {
+        GameState state;
+        state.init(benchPosition.state, benchPosition.color);
+        collect(state, 3);
+    }
+
+    bool same = true;
+    // the evaluators below all read the same tables, agreeing says nothing about which way up
+    // those are. a castled king has to beat one on the far rank, a pawn about to promote one at home
+    const int whiteKingHome = mgScore(GameState::pieceSquareScore('K', 6));
+    const int whiteKingAway = mgScore(GameState::pieceSquareScore('K', 62));
+    const int blackKingHome = -mgScore(GameState::pieceSquareScore('k', 62));
+    const int blackKingAway = -mgScore(GameState::pieceSquareScore('k', 6));
+    const int whitePawnHome = egScore(GameState::pieceSquareScore('P', 12));
+    const int whitePawnAway = egScore(GameState::pieceSquareScore('P', 52));
+    if (whiteKingHome <= whiteKingAway || blackKingHome <= blackKingAway || whitePawnHome >= whitePawnAway) {
+        std::cout << "piece square tables are upside down" << std::endl;
+        same = false;
+    }
+    // and the same position with the colours swapped scores the other way
+    for (const Position& position : positions) {
+        std::string mirrored(64, '0');
+        for (int square = 0; square < 64; square++) {
+            const char piece = position.state[square ^ 56];
+            mirrored[square] = piece == '0' ? '0' : piece ^ 0x20;
+        }
+        if (evaluateBoard(mirrored) != -position.score) {
+            std::cout << "colour mirrored position scores differently in " << std::string(position.state, 64) << std::endl;
+            same = false;
+            break;
+        }
+    }
+    for (const Position& position : positions) {
+        if (evaluateBoard(std::string(position.state, 64)) != position.score) {
+            std::cout << "evaluateBoard differs from the incremental score in " << std::string(position.state, 64) << std::endl;
+            same = false;
+            break;
+        }
+    }
+    for (auto implementation : { BoardEvaluator::Scalar, BoardEvaluator::SSE41, BoardEvaluator::AVX2 }) {
+        if (!BoardEvaluator::isSupported(implementation)) {
+            std::cout << std::setw(7) << BoardEvaluator::name(implementation) << " not supported" << std::endl;
+            continue;
+        }
+        long long checksum = 0;
+        const auto start = std::chrono::steady_clock::now();
+        for (int pass = 0; pass < 10; pass++) {
+            for (const Position& position : positions) {
+                checksum += BoardEvaluator::evaluate(position.state, implementation);
+            }
+        }
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        for (const Position& position : positions) {
+            if (BoardEvaluator::evaluate(position.state, implementation) != position.score) {
+                std::cout << BoardEvaluator::name(implementation) << " differs in " << std::string(position.state, 64) << std::endl;
+                same = false;
+                break;
+            }
+        }
+        std::cout << std::setw(7) << BoardEvaluator::name(implementation)
+                  << (implementation == BoardEvaluator::implementation() ? " (default)" : "")
+                  << " " << static_cast<long long>(positions.size() * 10 / std::max(seconds, 1e-9)) << " positions/s"
+                  << " checksum " << checksum << std::endl;
+    }
+    std::cout << positions.size() << " positions" << (same ? ", all evaluators agree" : ", evaluators differ") << std::endl;
+
+    // the network's output layer versions, on random accumulators and weights so no weights file
+    // is needed. the values run past both ends of the clipping range
+    if (BoardEvaluator::isSupported(BoardEvaluator::AVX2)) {
+        std::mt19937 random(1);
+        std::uniform_int_distribution<int> values(-300, 300);
+        std::uniform_int_distribution<int> weights(-128, 127);
+        NnueAccumulator accumulator;
+        int8_t outputWeights[2 * nnueHidden];
+        bool outputsAgree = true;
+        for (int trial = 0; trial < 10000 && outputsAgree; trial++) {
+            for (auto& half : accumulator.values) {
+                for (int16_t& value : half) {
+                    value = static_cast<int16_t>(values(random));
+                }
+            }
+            for (int8_t& weight : outputWeights) {
+                weight = static_cast<int8_t>(weights(random));
+            }
+            const int16_t* us = accumulator.values[0];
+            const int16_t* them = accumulator.values[1];
+            if (Nnue::outputSum(us, them, outputWeights, BoardEvaluator::Scalar) != Nnue::outputSum(us, them, outputWeights, BoardEvaluator::AVX2)) {
+                outputsAgree = false;
+            }
+        }
+        std::cout << (outputsAgree ? "network output layers agree" : "network output layers differ") << std::endl;
+        same = same && outputsAgree;
+    }
+
+    // the network only pays off if its updates keep up, so walk the same trees with and without it
+    if (_network.loaded() || _network.load(networkFile)) {
+        bool matches = true;
+        bool check = false;
+        long long nodes = 0;
+        long long checksum = 0;
+        std::function<void(GameState&, int)> walk = [&](GameState& state, int depth) {
+            nodes++;
+            checksum += state.evaluate();
+            if (depth == 0) {
+                return;
+            }
+            MoveList moves;
+            state.generateAllMoves(moves);
+            for (const BitMove& move : moves) {
+                state.pushMove(move);
+                if (check && matches && !state.evaluationMatchesState()) {
+                    std::cout << "network accumulator differs from a refresh in " << std::string(state.state, 64) << std::endl;
+                    matches = false;
+                }
+                walk(state, depth - 1);
+                state.popState();
+            }
+        };
+        for (const Nnue* network : { static_cast<const Nnue*>(nullptr), static_cast<const Nnue*>(&_network) }) {
+            nodes = 0;
+            checksum = 0;
+            const auto start = std::chrono::steady_clock::now();
+            for (const auto& benchPosition : benchPositions) {
+                GameState state;
+                state.init(benchPosition.state, benchPosition.color);
+                state.setNetwork(network);
+                walk(state, 3);
+            }
+            const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            std::cout << (network ? "network" : "tables") << " " << static_cast<long long>(nodes / std::max(seconds, 1e-9))
+                      << " nodes/s checksum " << checksum << std::endl;
+        }
+        // again with every accumulator compared to a refresh, too slow to time
+        check = true;
+        for (const auto& benchPosition : benchPositions) {
+            GameState state;
+            state.init(benchPosition.state, benchPosition.color);
+            state.setNetwork(&_network);
+            walk(state, 3);
+        }
+        std::cout << (matches ? "network accumulators match a refresh" : "network accumulators differ") << std::endl;
+        same = same && matches;
+    } else {
+        std::cout << "no network in " << networkFile << std::endl;
+    }
+    return same;
+}
+
+// Execute the best move on the actual board
+// I’m kind of amazed this code works and will be improving it
+void Chess::applyMove(const BitMove& move)
+{
+    int srcSquare = move.from;
+    int dstSquare = move.to;
+    BitHolder& src = getHolderAt(srcSquare&7, srcSquare/8);
+    BitHolder& dst = getHolderAt(dstSquare&7, dstSquare/8);
+    Bit* bit = src.bit();
+    dst.dropBitAtPoint(bit, ImVec2(0, 0));
+    src.setBit(nullptr);
+    bitMovedFromTo(*bit, src, dst);
+    startPonder();
+}
+
+// principal variation search over the root moves, the best one ends up in pvTable[0][0]
+int Chess::searchRoot(SearchThread& thread, int depth, int alpha, int beta, int rootColor)
+{
+    GameState& gamestate = thread.position;
+    std::vector<BitMove>& rootMoves = thread.rootMoves;
+    thread.pvLength[0] = 0;
     int bestVal = negInfinite;
-    BitMove bestMove;
-    GameState newGs;
-    newGs.init(stateString().c_str(), -1);
-    _countMoves = 0;
+    for (size_t i = 0; i < rootMoves.size(); i++) {
+        const BitMove& move = rootMoves[i];
+        gamestate.pushMove(move);
+        int value;
+        if (i == 0) {
+            value = -negamax<PV>(thread, gamestate, depth, -beta, -alpha, -rootColor);
+        } else {
+            // prove the move is worse with a null window, search it properly only if that fails
+            value = -negamax<NonPV>(thread, gamestate, depth, -alpha - 1, -alpha, -rootColor);
+            if (value > alpha && value < beta) {
+                value = -negamax<PV>(thread, gamestate, depth, -beta, -alpha, -rootColor);
+            }
+        }
+        gamestate.popState();
 
-    // Search through current legal moves
-    for(auto move : _moves) {
-        // std::cout << (int)move.from << ": " << (int)move.to << std::endl;
-        newGs.pushMove(move);
+        if (thread.aborted) {
+            return 0;
+        }
+        // the first move is the answer until another one beats it, even when every move gets mated
+        if (i == 0 || value > bestVal) {
+            bestVal = value;
+            if (i == 0 || value > alpha) {
+                updatePrincipalVariation(thread, 0, move);
+            }
+            if (value > alpha) {
+                alpha = value;
+                if (alpha >= beta) {
+                    break;
+                }
+            }
+        }
+    }
+    return bestVal;
+}
 
-        // Call negamax to evaluate this move
-        int moveVal = -negamax(newGs, _gameOptions.AIMAXDepth, negInfinite, posInfinite, 1);
+void Chess::updatePrincipalVariation(SearchThread& thread, int ply, const BitMove& move)
+{
+    thread.pvTable[ply][ply] = move;
+    for (int i = ply + 1; i < thread.pvLength[ply + 1]; i++) {
+        thread.pvTable[ply][i] = thread.pvTable[ply + 1][i];
+    }
+    thread.pvLength[ply] = std::max(thread.pvLength[ply + 1], ply + 1);
+}
 
-        newGs.popState();
+// keep the finished iteration's PV, along with the position keys along it, so the next
+// iteration can search those moves first
+void Chess::savePrincipalVariation(SearchThread& thread)
+{
+    GameState& gamestate = thread.position;
+    thread.prevPvLength = 0;
+    for (int i = 0; i < thread.pvLength[0]; i++) {
+        thread.pvKeys[i] = gamestate.hash();
+        thread.prevPv[i] = thread.pvTable[0][i];
+        thread.prevPvLength++;
+        gamestate.pushMove(thread.prevPv[i]);
+    }
+    for (int i = 0; i < thread.prevPvLength; i++) {
+        gamestate.popState();
+    }
+}
 
-        // Track the best move found
-        if (moveVal > bestVal) {
-            bestMove = move;
-            bestVal = moveVal;
+std::string Chess::moveNotation(const BitMove& move)
+{
+    std::string notation;
+    notation += static_cast<char>('a' + (move.from & 7));
+    notation += static_cast<char>('1' + (move.from >> 3));
+    notation += static_cast<char>('a' + (move.to & 7));
+    notation += static_cast<char>('1' + (move.to >> 3));
+    if (move.flags & IsPromotion) {
+        notation += 'q';
+    }
+    return notation;
+}
+
+// true once the time or node budget for this move has been used up
+bool Chess::searchBudgetExhausted(const SearchThread& thread)
+{
+    if (_stopRequested.load(std::memory_order_relaxed)) {
+        return true;
+    }
+    if (thread.id != 0 && _helpersStop.load(std::memory_order_relaxed)) {
+        return true;
+    }
+    const long long nodes = _totalNodes.load(std::memory_order_relaxed);
+    // pondering runs until the human moves, the budget starts with the ponder hit
+    if (_pondering.load(std::memory_order_relaxed)) {
+        _budgetNodeBase.store(nodes, std::memory_order_relaxed);
+        return false;
+    }
+    if (_gameOptions.AIMaxNodes > 0 && nodes - _budgetNodeBase.load(std::memory_order_relaxed) >= _gameOptions.AIMaxNodes) {
+        return true;
+    }
+    if (_gameOptions.AIMaxTimeMs > 0) {
+        return searchElapsedMs() >= _gameOptions.AIMaxTimeMs;
+    }
+    return false;
+}
+
+// only look at the clock every so often, it's not free. the node count is shared in
+// the same batches so the node budget covers all threads
+void Chess::countNodes(SearchThread& thread)
+{
+    thread.countMoves++;
+    if ((thread.countMoves & 2047) == 0) {
+        _totalNodes.fetch_add(2048, std::memory_order_relaxed);
+        if (searchBudgetExhausted(thread)) {
+            thread.aborted = true;
+        }
+    }
+}
+
+// margin on top of the captured piece before delta pruning gives up on a capture
+constexpr int deltaMargin = 200;
+// near the leaves a capture that loses more than this much per ply of depth left by SEE isn't searched
+constexpr int seePruneDepth = 3;
+constexpr int seePruneMargin = 100;
+// forward pruning near the leaves, each margin is per ply of depth left
+constexpr int reverseFutilityDepth = 6;
+constexpr int reverseFutilityMargin = 120;
+constexpr int futilityDepth = 3;
+constexpr int futilityMargin = 150;
+constexpr int razorDepth = 2;
+constexpr int razorMargin = 300;
+
+// mate scores are stored as the distance from the node rather than from the root,
+// the same entry can be reached at a different ply
+static int scoreToTT(int score, int ply)
+{
+    return score >= mateScore - MAX_DEPTH ? score + ply : (score <= -mateScore + MAX_DEPTH ? score - ply : score);
+}
+
+static int scoreFromTT(int score, int ply)
+{
+    return score >= mateScore - MAX_DEPTH ? score - ply : (score <= -mateScore + MAX_DEPTH ? score + ply : score);
+}
+
+// material only, used for pruning decisions, matches the material in GameState's piece square scores
+static int pieceMaterial(char piece)
+{
+    switch (piece | 0x20) {  // lower case
+        case 'p': return 100;
+        case 'n': return 200;
+        case 'b': return 230;
+        case 'r': return 400;
+        case 'q': return 900;
+        default: return 0;
+    }
+}
+
+// history scores are halved before they grow past this
+constexpr int historyMax = 50000;
+
+// a quiet move caused a beta cutoff, remember it as a killer and bump its history
+void Chess::updateQuietStats(SearchThread& thread, const GameState& gamestate, const BitMove& move, int depth, int ply)
+{
+    if (!(move == thread.killerMoves[ply][0])) {
+        thread.killerMoves[ply][1] = thread.killerMoves[ply][0];
+        thread.killerMoves[ply][0] = move;
+    }
+    int& history = thread.historyTable[gamestate.color == WHITE ? 0 : 1][move.from][move.to];
+    history += depth * depth;
+    if (history > historyMax) {
+        ageHistory(thread);
+    }
+}
+
+void Chess::ageHistory(SearchThread& thread)
+{
+    for (auto& side : thread.historyTable) {
+        for (auto& from : side) {
+            for (int& history : from) {
+                history /= 2;
+            }
+        }
+    }
+}
+
+// true once this thread's result no longer matters, the budget ran out or a split point
+// it is working for already failed high
+bool Chess::searchStopped(const SearchThread& thread) const
+{
+    if (thread.aborted) {
+        return true;
+    }
+    for (const SplitPoint* splitPoint = thread.splitPoint; splitPoint; splitPoint = splitPoint->parent) {
+        if (splitPoint->cutoff.load(std::memory_order_relaxed)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// one move of a node with principal variation search and late move reductions,
+// the position is the same again on return. only the first move of a PV node and the
+// re-searches of moves that beat alpha there are PV nodes themselves
+template <NodeType nodeType>
+int Chess::searchChild(SearchThread& thread, GameState& gamestate, const BitMove& move, size_t moveNumber, int depth,
+                       int alpha, int beta, int playerColor, bool inCheck)
+{
+    constexpr bool pvNode = nodeType == PV;
+    const bool quiet = !(move.flags & (IsCapture | EnPassant | IsPromotion));
+    gamestate.pushMove(move);
+    int value;
+    if (moveNumber == 0) {
+        value = -negamax<nodeType>(thread, gamestate, depth - 1, -beta, -alpha, -playerColor);
+    } else {
+        // late quiet moves are unlikely to be best, search them shallower first
+        int reduction = 0;
+        if (_useLateMoveReductions && quiet && !inCheck && depth >= 3 && moveNumber >= 3) {
+            reduction = _lmrReductions[std::min(depth, MAX_DEPTH)][std::min<size_t>(moveNumber, 63)] - (pvNode ? 1 : 0);
+            reduction = std::clamp(reduction, 0, depth - 2);
+        }
+        // principal variation search, the first move is expected to be best so the
+        // rest only have to be shown worse with a null window
+        value = -negamax<NonPV>(thread, gamestate, depth - 1 - reduction, -alpha - 1, -alpha, -playerColor);
+        if (reduction > 0 && value > alpha) {
+            value = -negamax<NonPV>(thread, gamestate, depth - 1, -alpha - 1, -alpha, -playerColor);
+        }
+        // a null window node has nothing strictly between alpha and beta
+        if constexpr (pvNode) {
+            if (value > alpha && value < beta) {
+                value = -negamax<PV>(thread, gamestate, depth - 1, -beta, -alpha, -playerColor);
+            }
+        }
+    }
+    // Undo the move
+    gamestate.popState();
+    return value;
+}
+
+bool Chess::canSplit(const SearchThread& thread, int depth) const
+{
+    return _parallelMode == YoungBrothersWait && _threads.size() > 1 && depth >= splitMinDepth && !thread.aborted;
+}
+
+// share out the moves as work items and help until all of them are done, firstMove is the
+// number the first of them has in the node's move order. alpha, bestVal and bestMove come
+// back updated, the PV row too if it changed
+void Chess::splitAndSearch(SearchThread& thread, GameState& gamestate, const MoveList& moves, size_t firstMove, int depth,
+                           int& alpha, int beta, int playerColor, bool pvNode, bool inCheck, int& bestVal, BitMove& bestMove)
+{
+    SplitPoint splitPoint;
+    splitPoint.parent = thread.splitPoint;
+    splitPoint.position = gamestate;
+    splitPoint.moves = moves.begin();
+    splitPoint.firstMove = static_cast<int>(firstMove);
+    splitPoint.moveCount = static_cast<int>(moves.size());
+    splitPoint.depth = depth;
+    splitPoint.beta = beta;
+    splitPoint.playerColor = playerColor;
+    splitPoint.pvNode = pvNode;
+    splitPoint.inCheck = inCheck;
+    splitPoint.alpha = alpha;
+    splitPoint.bestVal = bestVal;
+    splitPoint.bestMove = bestMove;
+    splitPoint.pending = splitPoint.moveCount;
+    _workPool.push(thread.id, &splitPoint, splitPoint.moveCount);
+
+    // while waiting only take work from below this split point, anything else could
+    // keep us busy long after our own node is finished
+    auto belowUs = [&splitPoint](SplitPoint* candidate) {
+        for (const SplitPoint* node = candidate; node; node = node->parent) {
+            if (node == &splitPoint) {
+                return true;
+            }
+        }
+        return false;
+    };
+    SplitPoint* item;
+    while (splitPoint.pending.load(std::memory_order_acquire) > 0) {
+        if (_workPool.pop(thread.id, item, belowUs) || _workPool.steal(thread.id, item, belowUs)) {
+            searchSplitPoint(thread, *item);
+        } else {
+            std::this_thread::yield();
+        }
+    }
+
+    alpha = splitPoint.alpha;
+    bestVal = splitPoint.bestVal;
+    bestMove = splitPoint.bestMove;
+    if (splitPoint.aborted) {
+        thread.aborted = true;
+    }
+    if (splitPoint.pvChanged) {
+        const int ply = gamestate.stackPtr;
+        std::copy(splitPoint.pv + ply, splitPoint.pv + splitPoint.pvLength, thread.pvTable[ply] + ply);
+        thread.pvLength[ply] = splitPoint.pvLength;
+    }
+}
+
+// one work item, searches moves of the split point that nobody took yet until there are none left.
+// the position is copied once for all of them, so the split point's other work items this thread
+// picks up later find nothing left and return without copying it again
+void Chess::searchSplitPoint(SearchThread& thread, SplitPoint& splitPoint)
+{
+    SplitPoint* const outer = thread.splitPoint;
+    thread.splitPoint = &splitPoint;
+
+    std::optional<GameState> position;
+    while (true) {
+        int index = -1;
+        int alpha = 0;
+        {
+            std::lock_guard<std::mutex> lock(splitPoint.lock);
+            if (!splitPoint.cutoff && splitPoint.nextMove < splitPoint.moveCount) {
+                index = splitPoint.nextMove++;
+                alpha = splitPoint.alpha;
+            }
+        }
+        if (index < 0 || searchStopped(thread)) {
+            break;
+        }
+        if (!position) {
+            position.emplace(splitPoint.position);
+        }
+        const BitMove move = splitPoint.moves[index];
+        const int moveNumber = splitPoint.firstMove + index;
+        const int value = splitPoint.pvNode
+            ? searchChild<PV>(thread, *position, move, moveNumber, splitPoint.depth, alpha, splitPoint.beta, splitPoint.playerColor, splitPoint.inCheck)
+            : searchChild<NonPV>(thread, *position, move, moveNumber, splitPoint.depth, alpha, splitPoint.beta, splitPoint.playerColor, splitPoint.inCheck);
+
+        std::lock_guard<std::mutex> lock(splitPoint.lock);
+        if (thread.aborted) {
+            splitPoint.aborted = true;
+            break;
+        }
+        if (!searchStopped(thread) && value > splitPoint.bestVal) {
+            splitPoint.bestVal = value;
+            splitPoint.bestMove = move;
+            if (value > splitPoint.alpha) {
+                splitPoint.alpha = value;
+                if (splitPoint.pvNode) {
+                    // same as updatePrincipalVariation, the child's line is in this thread's table
+                    const int ply = position->stackPtr;
+                    splitPoint.pv[ply] = move;
+                    for (int i = ply + 1; i < thread.pvLength[ply + 1]; i++) {
+                        splitPoint.pv[i] = thread.pvTable[ply + 1][i];
+                    }
+                    splitPoint.pvLength = std::max(thread.pvLength[ply + 1], ply + 1);
+                    splitPoint.pvChanged = true;
+                }
+                if (value >= splitPoint.beta) {
+                    // everyone still searching a sibling or anything below one gives up
+                    splitPoint.cutoff = true;
+                }
+            }
         }
     }
 
-    std::cout << bestVal << std::endl;
-    // Execute the best move on the actual board
-    // I’m kind of amazed this code works and will be improving it
-    if(bestVal != negInfinite) {
-        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - searchStart).count();
-        const double boardsPerSecond = seconds > 0.0 ? static_cast<double>(_countMoves) / seconds : 0.0;
-        std::cout << "Moves checked: " << _countMoves
-                    << " (" << std::fixed << std::setprecision(2) << boardsPerSecond
-                    << " boards/s)" << std::defaultfloat << std::endl;
+    thread.splitPoint = outer;
+    // the owner may return as soon as this hits zero, don't touch splitPoint after it
+    splitPoint.pending.fetch_sub(1, std::memory_order_release);
+}
 
-        int srcSquare = bestMove.from;
-        int dstSquare = bestMove.to;
-        BitHolder& src = getHolderAt(srcSquare&7, srcSquare/8);
-        BitHolder& dst = getHolderAt(dstSquare&7, dstSquare/8);
-        Bit* bit = src.bit();
-        dst.dropBitAtPoint(bit, ImVec2(0, 0));
-        src.setBit(nullptr);
-        bitMovedFromTo(*bit, src, dst);
+// young brothers wait helpers have no search of their own, they steal work items until the main thread is done
+void Chess::splitPointWorker(SearchThread& thread)
+{
+    resetSearchThread(thread);
+    auto anything = [](SplitPoint*) { return true; };
+    SplitPoint* item;
+    while (!_helpersStop.load(std::memory_order_acquire)) {
+        if (_workPool.steal(thread.id, item, anything)) {
+            searchSplitPoint(thread, *item);
+        } else {
+            std::this_thread::yield();
+        }
     }
 }
 
-int Chess::negamax(GameState& gamestate, int depth, int alpha, int beta, int playerColor)
+template <NodeType nodeType>
+int Chess::negamax(SearchThread& thread, GameState& gamestate, int depth, int alpha, int beta, int playerColor)
 {
-    _countMoves++;
+    // Base case: at leaf nodes, resolve captures before trusting the evaluation
+    // (also when the GameState stack is full, quiescence just stands pat there)
+    if (depth == 0 || gamestate.stackPtr >= MAX_DEPTH) {
+        return quiescence(thread, gamestate, alpha, beta, playerColor);
+    }
 
-    // Base case: at leaf nodes, evaluate the position
-    if (depth == 0) {
-        return evaluateBoard(gamestate.state) * playerColor;
+    countNodes(thread);
+    const int ply = gamestate.stackPtr;
+    thread.pvLength[ply] = ply;
+    if (searchStopped(thread)) {
+        return 0;
+    }
+    // a repeated position or fifty moves without progress is a draw whatever the evaluation says
+    if (ply > 0 && gamestate.isDraw()) {
+        return 0;
     }
 
-    // Generate moves for THIS board state (critical!)
-    std::vector<BitMove> newMoves = gamestate.generateAllMoves();
+    constexpr bool pvNode = nodeType == PV;
+    const int alphaOrig = alpha;
+    const uint64_t key = gamestate.hash();
+    BitMove ttMove;
+    TTEntry entry;
+    if (_tt.probe(key, entry)) {
+        ttMove = entry.move;
+        entry.score = scoreFromTT(entry.score, ply);
+        // PV nodes always search so the principal variation stays complete
+        if (!pvNode && entry.depth >= depth) {
+            if (entry.bound == TTExact ||
+                (entry.bound == TTLower && entry.score >= beta) ||
+                (entry.bound == TTUpper && entry.score <= alpha)) {
+                return entry.score;
+            }
+        }
+    }
+
+    const bool inCheck = gamestate.isInCheck();
+    // the pruning below trusts the static eval, not in check or where the exact line matters
+    const bool canPrune = !pvNode && !inCheck;
+    const int staticEval = canPrune ? evaluate(thread, gamestate) * playerColor : 0;
+
+    // reverse futility, so far above beta that the opponent won't get back in the few plies left
+    if (_useForwardPruning && canPrune && depth <= reverseFutilityDepth && staticEval - reverseFutilityMargin * depth >= beta) {
+        thread.pruningStats.reverseFutility++;
+        return staticEval;
+    }
+    // razoring, so far below alpha that only a capture could help, quiescence has the final word
+    if (_useForwardPruning && canPrune && depth <= razorDepth && staticEval + razorMargin * depth <= alpha) {
+        const int value = quiescence(thread, gamestate, alpha, beta, playerColor);
+        if (searchStopped(thread)) {
+            return 0;
+        }
+        if (value <= alpha) {
+            thread.pruningStats.razoring++;
+            return value;
+        }
+    }
+
+    // null move pruning, if passing the turn still fails high a real move will too.
+    // not when in check, right after another null move, or with only pawns left (zugzwang)
+    if (_useNullMove && canPrune && depth >= 3 && !(gamestate.flags & NullMovePlayed)
+        && gamestate.hasNonPawnMaterial(gamestate.color)
+        && staticEval >= beta) {
+        const int reduction = depth >= 6 ? 3 : 2;
+        gamestate.pushNullMove();
+        int value = -negamax<NonPV>(thread, gamestate, std::max(depth - 1 - reduction, 0), -beta, -beta + 1, -playerColor);
+        gamestate.popState();
+        if (searchStopped(thread)) {
+            return 0;
+        }
+        if (value >= beta) {
+            return value;
+        }
+    }
+
+    // moves come out of the picker best guess first and are generated in stages as needed
+    const bool followingPv = ply < thread.prevPvLength && key == thread.pvKeys[ply];
+    MovePicker picker(gamestate, followingPv ? thread.prevPv[ply] : BitMove(), ttMove,
+                      thread.killerMoves[ply], thread.historyTable[gamestate.color == WHITE ? 0 : 1]);
 
     int bestVal = negInfinite; // Start with worst possible value
+    BitMove bestMove;
 
-    for(const auto& move : newMoves) {
+    // the picker hands out losing captures last and the least bad first, so near the leaves
+    // the first one that loses too much ends the node
+    auto losingCapture = [&]() {
+        return canPrune && depth <= seePruneDepth && picker.lastSee() < -seePruneMargin * depth;
+    };
+    // futility, with the static eval this far below alpha a quiet move won't get there.
+    // the node's score becomes what the skipped moves could at best have scored
+    const int futilityValue = staticEval + futilityMargin * depth;
+    const bool futile = _useForwardPruning && canPrune && depth <= futilityDepth && futilityValue <= alpha;
+    auto futileMove = [&](const BitMove& candidate) {
+        if (!futile || (candidate.flags & (IsCapture | EnPassant | IsPromotion))) {
+            return false;
+        }
+        thread.pruningStats.futility++;
+        bestVal = std::max(bestVal, futilityValue);
+        return true;
+    };
+
+    BitMove move;
+    bool hasLegalMove = false;
+    bool firstSearched = false;
+    for (size_t i = 0; picker.next(move); i++) {
+        hasLegalMove = true;
+        if (i > 0 && losingCapture()) {
+            break;
+        }
+        if (i > 0 && futileMove(move)) {
+            continue;
+        }
+        // young brothers wait, the first move is searched alone and the rest can be shared out.
+        // whatever got pruned in between, this move is the first sibling still to search
+        if (firstSearched && canSplit(thread, depth)) {
+            MoveList siblings;
+            siblings.add(move);
+            while (picker.next(move) && !losingCapture()) {
+                if (!futileMove(move)) {
+                    siblings.add(move);
+                }
+            }
+            splitAndSearch(thread, gamestate, siblings, i, depth, alpha, beta, playerColor, pvNode, inCheck, bestVal, bestMove);
+            if (searchStopped(thread)) {
+                return 0;
+            }
+            if (bestVal >= beta && !(bestMove.flags & (IsCapture | EnPassant | IsPromotion))) {
+                updateQuietStats(thread, gamestate, bestMove, depth, ply);
+            }
+            break;
+        }
+        const bool quiet = !(move.flags & (IsCapture | EnPassant | IsPromotion));
+        int value = searchChild<nodeType>(thread, gamestate, move, i, depth, alpha, beta, playerColor, inCheck);
+        firstSearched = true;
+        if (searchStopped(thread)) {
+            return 0;
+        }
+        if (value > bestVal) {
+            bestVal = value;
+            bestMove = move;
+            if (value > alpha) {
+                alpha = value;
+                if constexpr (pvNode) {
+                    updatePrincipalVariation(thread, ply, move);
+                }
+                // alpha beta cut-off
+                if (alpha >= beta) {
+                    if (quiet) {
+                        updateQuietStats(thread, gamestate, move, depth, ply);
+                    }
+                    break;
+                }
+            }
+        }
+    }
+
+    // no legal move at all is mate or stalemate, moves futility skipped still count as legal
+    if (!hasLegalMove) {
+        bestVal = inCheck ? -(mateScore - ply) : 0;
+    }
+
+    TTBound bound = bestVal <= alphaOrig ? TTUpper : (bestVal >= beta ? TTLower : TTExact);
+    _tt.store(key, depth, scoreToTT(bestVal, ply), bound, bound == TTUpper ? BitMove() : bestMove);
+
+    return bestVal;
+}
+
+// static evaluation from white's side through the eval cache. the key has the side to move
+// in it, the network's score depends on that
+int Chess::evaluate(SearchThread& thread, GameState& gamestate)
+{
+    const uint64_t key = gamestate.hash();
+    int score;
+    switch (_evalCache.probe(key, score)) {
+        case EvalCache::Hit:
+            thread.evalCacheStats.hits++;
+            return score;
+        case EvalCache::Miss:
+            thread.evalCacheStats.misses++;
+            break;
+        case EvalCache::Collision:
+            thread.evalCacheStats.collisions++;
+            break;
+    }
+    score = gamestate.evaluate(thread.pawnTable);
+    _evalCache.store(key, score);
+    return score;
+}
+
+// captures and promotions only until the position is quiet, so the leaf evaluation
+// never happens halfway through an exchange. in check all evasions are searched instead
+int Chess::quiescence(SearchThread& thread, GameState& gamestate, int alpha, int beta, int playerColor)
+{
+    countNodes(thread);
+    thread.countQuiescence++;
+    thread.pvLength[gamestate.stackPtr] = gamestate.stackPtr;
+    if (searchStopped(thread)) {
+        return 0;
+    }
+    // only the first node can be a repetition, after it at least every other move is a capture
+    if (gamestate.stackPtr > 0 && gamestate.isDraw()) {
+        return 0;
+    }
+    // with only the king and pawns left running out of moves is a real danger and standing pat
+    // would miss it. with pieces around it is rare enough to leave to the full width search
+    if (!gamestate.hasNonPawnMaterial(gamestate.color)) {
+        MoveList moves;
+        gamestate.generateAllMoves(moves);
+        if (moves.empty()) {
+            return gamestate.isInCheck() ? -(mateScore - gamestate.stackPtr) : 0;
+        }
+    }
+
+    const int ply = gamestate.stackPtr;
+    if (ply >= MAX_DEPTH) {
+        return evaluate(thread, gamestate) * playerColor;
+    }
+
+    // in check there is no standing pat and every evasion is searched, otherwise a mate
+    // at the horizon would get the static score. no evasion at all is mate
+    const bool inCheck = gamestate.isInCheck();
+    int standPat = 0;
+    int bestVal = -(mateScore - ply);
+    if (!inCheck) {
+        // stand pat, the side to move can usually do at least as well as doing nothing
+        standPat = evaluate(thread, gamestate) * playerColor;
+        if (standPat >= beta) {
+            return standPat;
+        }
+        // delta pruning, not even winning a queen gets us back to alpha
+        if (standPat + pieceMaterial('q') + deltaMargin < alpha) {
+            return standPat;
+        }
+        alpha = std::max(alpha, standPat);
+        bestVal = standPat;
+    }
+
+    MovePicker picker = inCheck ? MovePicker(gamestate, BitMove(), BitMove(), thread.killerMoves[ply],
+                                             thread.historyTable[gamestate.color == WHITE ? 0 : 1])
+                                : MovePicker(gamestate);
+    BitMove move;
+    while (picker.next(move)) {
+        // this capture alone can't raise alpha
+        if (!inCheck && !(move.flags & IsPromotion)) {
+            const int gain = (move.flags & EnPassant) ? pieceMaterial('p') : pieceMaterial(gamestate.state[move.to]);
+            if (standPat + gain + deltaMargin <= alpha) {
+                continue;
+            }
+        }
         gamestate.pushMove(move);
-        bestVal = std::max(bestVal, -negamax(gamestate, depth - 1, -beta, -alpha, -playerColor));
-        // Undo the move
+        int value = -quiescence(thread, gamestate, -beta, -alpha, -playerColor);
         gamestate.popState();
-        // alpha beta cut-off
-        alpha = std::max(alpha, bestVal);
-        if (alpha >= beta) {
-            break;
+        if (searchStopped(thread)) {
+            return 0;
+        }
+        if (value > bestVal) {
+            bestVal = value;
+            if (value >= beta) {
+                break;
+            }
+            alpha = std::max(alpha, value);
         }
     }
 
@@ -1,13 +1,126 @@
 #pragma once
 
+#include <memory>
+#include <mutex>
 #include "Game.h"
 #include "Grid.h"
 #include "Bitboard.h"
 #include "GameState.h"
+#include "Nnue.h"
+#include "TranspositionTable.h"
+#include "EvalCache.h"
+#include "TripleBuffer.h"
+#include "WorkStealingPool.h"
 
 // FILE = COL
 // RANK = ROW
 constexpr int pieceSize = 80;
+// size of the transposition table, kept between turns
+constexpr int transpositionTableMB = 32;
+// static evaluations of positions seen before, shared like the transposition table
+constexpr int evalCacheMB = 2;
+// weights for the optional network evaluation, the game runs on the piece square tables without it
+constexpr const char* networkFile = "resources/chess.nnue";
+// half width of the first aspiration window around the previous iteration's score
+constexpr int aspirationWindow = 50;
+// being mated n plies from the root scores -(mateScore - n), well inside the window sentinels
+// so a mated line never looks like nothing was searched
+constexpr int mateScore = 100000;
+
+// lazy SMP helpers searching next to the main thread, they only share the transposition table
+constexpr int maxSearchThreads = 16;
+// young brothers wait only shares out nodes with at least this much depth left
+constexpr int splitMinDepth = 3;
+
+enum ParallelMode {
+    LazySMP,            // every thread searches the whole tree, sharing the transposition table
+    YoungBrothersWait   // the main thread searches, helpers steal sibling moves at split points
+};
+
+// negamax is compiled once per node type. PV nodes have an open window and keep the principal
+// variation up to date, the null window searches that make up nearly all nodes skip that work
+// and are the only ones allowed to prune on the static eval. the root has searchRoot
+enum NodeType {
+    NonPV,
+    PV
+};
+
+// what the search worker reports after every finished iteration
+struct SearchProgress {
+    int depth = 0;
+    int score = 0;      // from white's point of view
+    long long nodes = 0;
+    int pvLength = 0;
+    BitMove pv[MAX_DEPTH + 1];
+};
+
+// a node whose remaining moves get shared out, after its owner searched the first one alone.
+// every move left is one work item, whoever runs an item takes the next move in order
+struct SplitPoint {
+    SplitPoint* parent = nullptr;   // split point the owner was working for, cutoffs there stop us too
+    GameState position;
+    const BitMove* moves = nullptr;
+    int firstMove = 0;              // index of moves[0] in the node's move list, for the reductions
+    int moveCount = 0;
+    int depth = 0;
+    int beta = 0;
+    int playerColor = 0;
+    bool pvNode = false;
+    bool inCheck = false;
+
+    std::mutex lock;
+    // guarded by lock
+    int nextMove = 0;
+    int alpha = 0;
+    int bestVal = 0;
+    BitMove bestMove;
+    bool aborted = false;
+    bool pvChanged = false;
+    BitMove pv[MAX_DEPTH + 1];      // indexed by ply like a row of the PV table
+    int pvLength = 0;
+
+    // read without the lock
+    std::atomic<bool> cutoff{false};
+    std::atomic<int> pending{0};    // work items not finished yet, the owner waits for zero
+};
+
+// how often each forward pruning near the leaves fired
+struct PruningStats {
+    long long reverseFutility = 0;  // nodes cut by static eval minus a margin still reaching beta
+    long long futility = 0;         // quiet moves skipped, static eval plus a margin can't reach alpha
+    long long razoring = 0;         // nodes where quiescence confirmed a hopeless static eval
+};
+
+// everything one search thread writes while it searches. thread 0 is the main search,
+// the rest are lazy SMP helpers working on their own copy of the root position
+struct SearchThread {
+    int id = 0;
+    GameState position;
+    std::vector<BitMove> rootMoves;
+    std::thread thread;
+    // move ordering, killers are per ply and cleared every search, history is aged between turns
+    BitMove killerMoves[MAX_DEPTH][2];
+    int historyTable[2][64][64] = {};
+    // pawn structure scores, kept between searches like the history
+    PawnHashTable pawnTable;
+    EvalCacheStats evalCacheStats;
+    PruningStats pruningStats;
+    // triangular PV table, row ply holds the best line found from that ply on
+    BitMove pvTable[MAX_DEPTH + 1][MAX_DEPTH + 1];
+    int pvLength[MAX_DEPTH + 1] = {};
+    // the last finished iteration's PV and the position keys along it, searched first next iteration
+    BitMove prevPv[MAX_DEPTH + 1];
+    uint64_t pvKeys[MAX_DEPTH + 1] = {};
+    int prevPvLength = 0;
+    int countMoves = 0;
+    int countQuiescence = 0;    // nodes that were only searched by quiescence, included in countMoves
+    bool aborted = false;
+    SplitPoint* splitPoint = nullptr;   // innermost split point this thread is searching for
+    // result of the last finished iteration
+    int completedDepth = 0;
+    int bestScore = 0;
+    BitMove bestMove;
+};
 
 class Chess : public Game
 {
@@ -33,6 +146,18 @@ public:
     void setStateString(const std::string &s) override;
 
     Grid* getGrid() override { return _grid; }
+    void drawSettings() override;
+
+    // fixed depth searches of a few positions with 1, 2, 4, 8 and 16 threads in both
+    // parallel modes, prints time to depth.
+    // needs no window, main() runs it for the "bench" argument
+    void benchThreads(int depth);
+    // perft of the bench positions with the legal move generator and the old filtering one,
+    // checks they agree move for move and times both. false on any difference
+    bool benchPerft(int depth);
+    // every position within three plies of the bench positions through each board evaluator
+    // this cpu runs, checks they match evaluateBoard and the incremental score, prints positions/s
+    bool benchEvaluation();
 
 private:
     Bit* PieceForPlayer(const int playerNumber, ChessPiece piece);
@@ -40,11 +165,45 @@ private:
     void FENtoBoard(const std::string& fen);
     char pieceNotation(int x, int y) const;
     void endTurn() override;
+    void bitMovedFromTo(Bit &bit, BitHolder &src, BitHolder &dst) override;
 
     void GenKnightBoards();
     void GenKingBoards();
     int evaluateBoard(const std::string& state);
-    int negamax(GameState& gamestate, int depth, int alpha, int beta, int playerColor);
+    void initSearch();
+    template <NodeType nodeType>
+    int negamax(SearchThread& thread, GameState& gamestate, int depth, int alpha, int beta, int playerColor);
+    int quiescence(SearchThread& thread, GameState& gamestate, int alpha, int beta, int playerColor);
+    int evaluate(SearchThread& thread, GameState& gamestate);
+    void startSearch();
+    void startPonder();
+    void launchSearch(const GameState& rootState, const std::vector<BitMove>& rootMoves, int rootColor, bool ponder);
+    // hands the root the game's positions since the last capture or pawn move, from _turns
+    void loadGameHistory(GameState& rootState) const;
+    void stopSearch();
+    long long searchElapsedMs() const;
+    void searchWorker(GameState rootState, std::vector<BitMove> rootMoves, int rootColor);
+    BitMove runSearch(const GameState& rootState, const std::vector<BitMove>& rootMoves, int rootColor);
+    void resetSearchThread(SearchThread& thread);
+    void iterativeDeepening(SearchThread& thread, int rootColor);
+    void splitPointWorker(SearchThread& thread);
+    bool canSplit(const SearchThread& thread, int depth) const;
+    void splitAndSearch(SearchThread& thread, GameState& gamestate, const MoveList& moves, size_t firstMove, int depth,
+                        int& alpha, int beta, int playerColor, bool pvNode, bool inCheck, int& bestVal, BitMove& bestMove);
+    void searchSplitPoint(SearchThread& thread, SplitPoint& splitPoint);
+    bool searchStopped(const SearchThread& thread) const;
+    template <NodeType nodeType>
+    int searchChild(SearchThread& thread, GameState& gamestate, const BitMove& move, size_t moveNumber, int depth,
+                    int alpha, int beta, int playerColor, bool inCheck);
+    void applyMove(const BitMove& move);
+    int searchRoot(SearchThread& thread, int depth, int alpha, int beta, int rootColor);
+    void updatePrincipalVariation(SearchThread& thread, int ply, const BitMove& move);
+    void savePrincipalVariation(SearchThread& thread);
+    std::string moveNotation(const BitMove& move);
+    bool searchBudgetExhausted(const SearchThread& thread);
+    void countNodes(SearchThread& thread);
+    void updateQuietStats(SearchThread& thread, const GameState& gamestate, const BitMove& move, int depth, int ply);
+    void ageHistory(SearchThread& thread);
 
     Grid* _grid;
     GameState gs;
@@ -55,11 +214,52 @@ private:
 
     BitBoard _knightBoards[64];
     BitBoard _kingBoards[64];
-    int _pieceSquares[128][64];
     std::vector<BitMove> _moves;
     std::vector<ChessSquare*> _highlights;
+    // shared by all search threads, nothing else is
+    TranspositionTable _tt;
+    EvalCache _evalCache;
+    // the cache holds scores of one evaluator, cleared when a search switches to the other
+    const Nnue* _evalCacheNetwork = nullptr;
+    // _threads[0] is the main search and keeps its history between turns
+    std::vector<std::unique_ptr<SearchThread>> _threads;
+    std::atomic<int> _searchThreads{1};
+    std::atomic<int> _parallelMode{LazySMP};
+    WorkStealingPool<SplitPoint*> _workPool;
+    // best line of the last finished search, what pondering guesses the human will play
+    BitMove _resultPv[MAX_DEPTH + 1];
+    int _resultPvLength = 0;
+    long long _lastSearchNodes = 0;
+    PruningStats _lastSearchPruning;
+    // selectivity, switchable from the settings window so their effect can be measured
+    std::atomic<bool> _useNullMove{true};
+    std::atomic<bool> _useLateMoveReductions{true};
+    std::atomic<bool> _useForwardPruning{true};
+    int _lmrReductions[MAX_DEPTH + 1][64];
     
     int negInfinite = -1000000;
     int posInfinite = 1000000;
-    int _countMoves = 0;
+
+    // iterative deepening budget, checked every few thousand nodes.
+    // nodes get added to _totalNodes in batches so the node budget covers every thread
+    std::atomic<std::chrono::steady_clock::rep> _searchStartTicks{0};
+    std::atomic<long long> _totalNodes{0};
+    std::atomic<long long> _budgetNodeBase{0};
+    // set once the main thread is done, the helpers give up their iteration
+    std::atomic<bool> _helpersStop{false};
+
+    // the search runs on _searchThread, the render loop only polls _searchFinished
+    std::thread _searchThread;
+    std::atomic<bool> _stopRequested{false};
+    std::atomic<bool> _searchFinished{false};
+    BitMove _searchResult;
+    TripleBuffer<SearchProgress> _progress;
+    // pondering searches the position after the human's expected reply until they move
+    std::atomic<bool> _usePondering{true};
+    std::atomic<bool> _pondering{false};
+    std::string _ponderState;
+    // optional network evaluation, only offered when the weights file is there.
+    // a change takes effect at the next search
+    Nnue _network;
+    std::atomic<bool> _useNetwork{false};
 };
\ No newline at end of file
@@ -0,0 +1,21 @@
+#include "EvalCache.h"
+
+void EvalCache::resize(size_t megabytes)
+{
+    size_t entries = 1;
+    while (entries * 2 * sizeof(EvalCacheEntry) <= megabytes * 1024 * 1024) {
+        entries *= 2;
+    }
+    _entries.reset(new EvalCacheEntry[entries]);
+    _numEntries = entries;
+    _mask = entries - 1;
+    clear();
+}
+
+void EvalCache::clear()
+{
+    for (size_t i = 0; i < _numEntries; i++) {
+        _entries[i].keyXorData.store(0, std::memory_order_relaxed);
+        _entries[i].data.store(0, std::memory_order_relaxed);
+    }
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+
+// static evaluations by position key, shared by every search thread. direct mapped,
+// one 16 byte entry per key. like the transposition table the key is stored xor'd
+// with the data, so an entry two threads wrote at once matches neither key
+struct EvalCacheEntry {
+    std::atomic<uint64_t> keyXorData{0};
+    std::atomic<uint64_t> data{0};
+};
+
+class EvalCache
+{
+public:
+    enum ProbeResult {
+        Hit,
+        Miss,       // nothing in the entry
+        Collision   // another position is in the entry, it gets replaced
+    };
+
+    // size is rounded down to a power of two number of entries
+    void resize(size_t megabytes);
+    void clear();
+
+    ProbeResult probe(uint64_t key, int& score) const {
+        if (!_numEntries) {
+            return Miss;
+        }
+        const EvalCacheEntry& entry = _entries[key & _mask];
+        const uint64_t data = entry.data.load(std::memory_order_relaxed);
+        if (!(data & validBit)) {
+            return Miss;
+        }
+        if ((entry.keyXorData.load(std::memory_order_relaxed) ^ data) != key) {
+            return Collision;
+        }
+        score = static_cast<int32_t>(static_cast<uint32_t>(data));
+        return Hit;
+    }
+    void store(uint64_t key, int score) {
+        if (!_numEntries) {
+            return;
+        }
+        EvalCacheEntry& entry = _entries[key & _mask];
+        const uint64_t data = static_cast<uint32_t>(score) | validBit;
+        entry.keyXorData.store(key ^ data, std::memory_order_relaxed);
+        entry.data.store(data, std::memory_order_relaxed);
+    }
+
+private:
+    static constexpr uint64_t validBit = 1ULL << 32;
+
+    std::unique_ptr<EvalCacheEntry[]> _entries;
+    uint64_t _mask = 0;
+    size_t _numEntries = 0;
+};
+
+// what a thread's probes found, summed over the threads after a search
+struct EvalCacheStats {
+    long long hits = 0;
+    long long misses = 0;
+    long long collisions = 0;
+};
@@ -41,6 +41,8 @@ struct GameOptions
 	int score;
 	int AIDepthSearches;
 	int AIMAXDepth;
+	int AIMaxTimeMs;		// wall-clock budget per AI move, 0 = unlimited
+	long long AIMaxNodes;	// node budget per AI move, 0 = unlimited
 	bool AIvsAI;
 };
 
@@ -96,6 +98,8 @@ public:
 	virtual bool gameHasAI();
 	virtual void updateAI();
 	virtual void pieceTaken(Bit *bit){};
+	// extra game specific controls for the settings window
+	virtual void drawSettings(){};
 
 	virtual std::string initialStateString() = 0;
 	virtual std::string stateString() = 0;
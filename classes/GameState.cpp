@@ -1,87 +1,466 @@
 
 #include <algorithm>
 #include <iostream>
+#include <atomic>
+#include <mutex>
+#include <tuple>
 #include "GameState.h"
 #include "MagicBitboards.h"
+#include "PieceSquare.h"
 
-static int _bitboardLookup[128];
-static bool _initedMagic = false;
+// every search thread inits its own GameState, the shared tables are only built once
+static std::mutex _initMutex;
+static std::atomic<bool> _initedMagic{false};
 static BitBoard _pawnAttacks[2][64]; // Precomputed pawn attacks for each square
+// squares strictly between two squares on a line, and the whole line through both. zero when not on a line
+static uint64_t _betweenMasks[64][64];
+static uint64_t _lineMasks[64][64];
+// squares in front of a pawn on its own and the neighbouring files, no enemy pawn there means it is passed
+static uint64_t _passedMasks[2][64];
+static uint64_t _adjacentFiles[8];
+
+uint64_t GameState::_zobristPieces[128][64];
+uint64_t GameState::_zobristCastling[16];
+uint64_t GameState::_zobristEnPassant[8];
+uint64_t GameState::_zobristSide;
+unsigned char GameState::_castlingMask[64];
+unsigned char GameState::_bitboardLookup[128];
+unsigned char GameState::_sideLookup[128];
+uint64_t GameState::_pawnKeyMask[128];
+int GameState::_pieceSquareScores[128][64];
+int GameState::_phaseWeights[128];
+
+// splitmix64, fixed seed so keys are the same every run
+static uint64_t nextZobristKey(uint64_t& seed) {
+    uint64_t z = (seed += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+void GameState::initZobristKeys() {
+    uint64_t seed = 0x4368657373ULL;
+    const char* pieces = "PNBRQKpnbrqk";
+    for (const char* p = pieces; *p; p++) {
+        for (int square = 0; square < 64; square++) {
+            _zobristPieces[(unsigned char)*p][square] = nextZobristKey(seed);
+        }
+    }
+    // castling keys are per right so any combination is the xor of its bits
+    uint64_t rightKeys[4];
+    for (int i = 0; i < 4; i++) {
+        rightKeys[i] = nextZobristKey(seed);
+    }
+    for (int rights = 0; rights < 16; rights++) {
+        _zobristCastling[rights] = 0;
+        for (int i = 0; i < 4; i++) {
+            if (rights & (1 << i)) {
+                _zobristCastling[rights] ^= rightKeys[i];
+            }
+        }
+    }
+    for (int file = 0; file < 8; file++) {
+        _zobristEnPassant[file] = nextZobristKey(seed);
+    }
+    _zobristSide = nextZobristKey(seed);
+    for (int i = 0; i < 128; i++) {
+        _pawnKeyMask[i] = 0;
+    }
+    _pawnKeyMask['P'] = ~0ULL;
+    _pawnKeyMask['p'] = ~0ULL;
+
+    for (int square = 0; square < 64; square++) {
+        _castlingMask[square] = AllCastlingRights;
+    }
+    _castlingMask[0] = AllCastlingRights & ~WhiteQueenSide;
+    _castlingMask[4] = AllCastlingRights & ~(WhiteKingSide | WhiteQueenSide);
+    _castlingMask[7] = AllCastlingRights & ~WhiteKingSide;
+    _castlingMask[56] = AllCastlingRights & ~BlackQueenSide;
+    _castlingMask[60] = AllCastlingRights & ~(BlackKingSide | BlackQueenSide);
+    _castlingMask[63] = AllCastlingRights & ~BlackKingSide;
+}
+
+uint64_t GameState::computeZobristHash() const {
+    uint64_t hash = 0;
+    for (int square = 0; square < 64; square++) {
+        hash ^= _zobristPieces[(unsigned char)state[square]][square];
+    }
+    hash ^= _zobristCastling[castling];
+    if (enPassantSquare >= 0) {
+        hash ^= _zobristEnPassant[enPassantSquare & 7];
+    }
+    if (color == BLACK) {
+        hash ^= _zobristSide;
+    }
+    return hash;
+}
+
+uint64_t GameState::computePawnKey() const {
+    uint64_t key = 0;
+    for (int square = 0; square < 64; square++) {
+        key ^= _zobristPieces[(unsigned char)state[square]][square] & _pawnKeyMask[(unsigned char)state[square]];
+    }
+    return key;
+}
 
 void GameState::init(const char* newState, char player) {
     std::memcpy(state, newState, 64);
     color = player;
     flags = 0;
-    _zobristHash[0] = 0;
-    _zobristHash[1] = 0;
+    enPassantSquare = -1;
+    halfmoveClock = 0;
+    stackPtr = 0;
+    _history.clear();
+    // a search never gets past MAX_DEPTH, perft and the like grow it further
+    undoStack.reserve(MAX_DEPTH);
     _attackBitBoard.setData(0);
     // Clear all bitboards
     for (int i = 0; i < e_numBitboards; ++i) {
         _bitboards[i].setData(0);
     }
 
-    if (!_initedMagic) {
-        initMagicBitboards();
-        // remove branching when we make the bitboards
-        for(int i=0; i<128; i++) { _bitboardLookup[i] = 0; }
-
-        _bitboardLookup['P'] = WHITE_PAWNS;
-        _bitboardLookup['N'] = WHITE_KNIGHTS;
-        _bitboardLookup['B'] = WHITE_BISHOPS;
-        _bitboardLookup['R'] = WHITE_ROOKS;
-        _bitboardLookup['Q'] = WHITE_QUEENS;
-        _bitboardLookup['K'] = WHITE_KING;
-        _bitboardLookup['p'] = BLACK_PAWNS;
-        _bitboardLookup['n'] = BLACK_KNIGHTS;
-        _bitboardLookup['b'] = BLACK_BISHOPS;
-        _bitboardLookup['r'] = BLACK_ROOKS;
-        _bitboardLookup['q'] = BLACK_QUEENS;
-        _bitboardLookup['k'] = BLACK_KING;
-        _bitboardLookup['0'] = EMPTY_SQUARES;
-
-        for(int square = 0; square < 64; square++) {
-            _pawnAttacks[0][square].setData(generatePawnAttacksBitBoard(square, WHITE));
-            _pawnAttacks[1][square].setData(generatePawnAttacksBitBoard(square, BLACK));
+    if (!_initedMagic.load(std::memory_order_acquire)) {
+        std::lock_guard<std::mutex> lock(_initMutex);
+        if (!_initedMagic.load(std::memory_order_relaxed)) {
+            initMagicBitboards();
+            // remove branching when we make the bitboards
+            for(int i=0; i<128; i++) { _bitboardLookup[i] = 0; }
+
+            _bitboardLookup['P'] = WHITE_PAWNS;
+            _bitboardLookup['N'] = WHITE_KNIGHTS;
+            _bitboardLookup['B'] = WHITE_BISHOPS;
+            _bitboardLookup['R'] = WHITE_ROOKS;
+            _bitboardLookup['Q'] = WHITE_QUEENS;
+            _bitboardLookup['K'] = WHITE_KING;
+            _bitboardLookup['p'] = BLACK_PAWNS;
+            _bitboardLookup['n'] = BLACK_KNIGHTS;
+            _bitboardLookup['b'] = BLACK_BISHOPS;
+            _bitboardLookup['r'] = BLACK_ROOKS;
+            _bitboardLookup['q'] = BLACK_QUEENS;
+            _bitboardLookup['k'] = BLACK_KING;
+            _bitboardLookup['0'] = EMPTY_SQUARES;
+
+            for (int i = 0; i < 128; i++) { _sideLookup[i] = OCCUPANCY; }
+            for (const char* piece = "PNBRQK"; *piece; piece++) {
+                _sideLookup[(unsigned char)*piece] = WHITE_ALL_PIECES;
+                _sideLookup[(unsigned char)(*piece | 0x20)] = BLACK_ALL_PIECES;
+            }
+
+            initPieceSquareScores();
+
+            for(int square = 0; square < 64; square++) {
+                _pawnAttacks[0][square].setData(generatePawnAttacksBitBoard(square, WHITE));
+                _pawnAttacks[1][square].setData(generatePawnAttacksBitBoard(square, BLACK));
+            }
+
+            for (int from = 0; from < 64; from++) {
+                for (int to = 0; to < 64; to++) {
+                    const uint64_t fromMask = 1ULL << from;
+                    const uint64_t toMask = 1ULL << to;
+                    _betweenMasks[from][to] = 0;
+                    _lineMasks[from][to] = 0;
+                    if (from == to) {
+                        continue;
+                    }
+                    if (getRookAttacks(from, 0) & toMask) {
+                        _betweenMasks[from][to] = getRookAttacks(from, toMask) & getRookAttacks(to, fromMask);
+                        _lineMasks[from][to] = (getRookAttacks(from, 0) & getRookAttacks(to, 0)) | fromMask | toMask;
+                    } else if (getBishopAttacks(from, 0) & toMask) {
+                        _betweenMasks[from][to] = getBishopAttacks(from, toMask) & getBishopAttacks(to, fromMask);
+                        _lineMasks[from][to] = (getBishopAttacks(from, 0) & getBishopAttacks(to, 0)) | fromMask | toMask;
+                    }
+                }
+            }
+
+            const uint64_t fileA = 0x0101010101010101ULL;
+            for (int file = 0; file < 8; file++) {
+                _adjacentFiles[file] = (file > 0 ? fileA << (file - 1) : 0) | (file < 7 ? fileA << (file + 1) : 0);
+            }
+            for (int square = 0; square < 64; square++) {
+                const uint64_t files = _adjacentFiles[square & 7] | (fileA << (square & 7));
+                const int rank = square / 8;
+                const uint64_t above = rank < 7 ? ~0ULL << ((rank + 1) * 8) : 0;
+                const uint64_t below = rank > 0 ? ~0ULL >> ((8 - rank) * 8) : 0;
+                _passedMasks[0][square] = files & above;
+                _passedMasks[1][square] = files & below;
+            }
+
+            initZobristKeys();
+
+            _initedMagic.store(true, std::memory_order_release);
+
+            std::cout << "initialized magic bitboards and bitboard lookup" << std::endl;
+        }
+    }
+
+    // the board string has no castling field, so assume the rights are there while king and rook are home
+    castling = 0;
+    if (state[4] == 'K') {
+        if (state[7] == 'R') castling |= WhiteKingSide;
+        if (state[0] == 'R') castling |= WhiteQueenSide;
+    }
+    if (state[60] == 'k') {
+        if (state[63] == 'r') castling |= BlackKingSide;
+        if (state[56] == 'r') castling |= BlackQueenSide;
+    }
+
+    _zobristHash[0] = computeZobristHash();
+    _zobristHash[1] = _zobristHash[0] ^ _zobristSide;
+    pawnKey = computePawnKey();
+    updateBitboards();
+
+    psqtScore = 0;
+    phase = 0;
+    for (int square = 0; square < 64; square++) {
+        psqtScore += _pieceSquareScores[(unsigned char)state[square]][square];
+        phase += _phaseWeights[(unsigned char)state[square]];
+    }
+    if (_network) {
+        refreshAccumulator();
+    }
+}
+
+void GameState::setNetwork(const Nnue* network)
+{
+    _network = network && network->loaded() ? network : nullptr;
+    if (_network) {
+        refreshAccumulator();
+    }
+}
+
+void GameState::setHistory(const std::vector<uint64_t>& keys)
+{
+    _history = keys;
+    // every one of them came after the last irreversible move
+    halfmoveClock = static_cast<unsigned char>(std::min<size_t>(keys.size(), 255));
+}
+
+bool GameState::isRepetition() const
+{
+    const uint64_t key = _zobristHash[0];
+    const int reach = std::min<int>(halfmoveClock, stackPtr + static_cast<int>(_history.size()));
+    int earlier = 0;
+    // only the same side to move can repeat, and it takes at least two moves each to get back
+    for (int distance = 4; distance <= reach; distance += 2) {
+        const int ply = stackPtr - distance;
+        const uint64_t seen = ply >= 0 ? undoStack[ply].hash : _history[_history.size() + ply];
+        if (seen == key && (ply >= 0 || ++earlier == 2)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void GameState::refreshAccumulator()
+{
+    NnueAccumulator& accumulator = pushAccumulator();
+    _network->refresh(state, 0, accumulator);
+    _network->refresh(state, 1, accumulator);
+}
+
+void GameState::updateAccumulator()
+{
+    const UndoRecord& undo = undoStack[stackPtr - 1];
+    const BitMove& move = undo.move;
+    const unsigned char moved = state[move.to];
+    const unsigned char mover = (move.flags & IsPromotion) ? (color == WHITE ? 'p' : 'P') : moved;
+
+    // squares that lost a piece and squares that gained one, kings included, featureIndex skips them
+    int removedSquares[3] = { move.from, move.to, -1 };
+    unsigned char removedPieces[3] = { mover, undo.captured, '0' };
+    int addedSquares[2] = { move.to, -1 };
+    unsigned char addedPieces[2] = { moved, '0' };
+    if (move.flags & KingSideCastle) {
+        removedSquares[2] = move.to + 1;
+        addedSquares[1] = move.to - 1;
+    } else if (move.flags & QueenSideCastle) {
+        removedSquares[2] = move.to - 2;
+        addedSquares[1] = move.to + 1;
+    } else if (move.flags & EnPassant) {
+        removedSquares[2] = mover == 'P' ? move.to - 8 : move.to + 8;
+        removedPieces[2] = mover == 'P' ? 'p' : 'P';
+    }
+    if (addedSquares[1] >= 0) {
+        addedPieces[1] = state[addedSquares[1]];
+        removedPieces[2] = addedPieces[1];
+    }
+
+    // grow first, that may move the parent
+    NnueAccumulator& child = pushAccumulator();
+    const NnueAccumulator& parent = _accumulators[stackPtr - 1];
+    for (int perspective = 0; perspective < 2; perspective++) {
+        const unsigned char king = perspective == 0 ? 'K' : 'k';
+        // every feature is relative to the king, when it moves the whole half changes
+        if (mover == king) {
+            _network->refresh(state, perspective, child);
+            continue;
+        }
+        const char* kingAt = static_cast<const char*>(std::memchr(state, king, 64));
+        const int kingSquare = kingAt ? static_cast<int>(kingAt - state) : 0;
+        int removed[3];
+        int added[2];
+        int removedCount = 0;
+        int addedCount = 0;
+        for (int i = 0; i < 3; i++) {
+            if (removedSquares[i] >= 0) {
+                const int feature = Nnue::featureIndex(perspective, kingSquare, removedPieces[i], removedSquares[i]);
+                if (feature >= 0) {
+                    removed[removedCount++] = feature;
+                }
+            }
         }
+        for (int i = 0; i < 2; i++) {
+            if (addedSquares[i] >= 0) {
+                const int feature = Nnue::featureIndex(perspective, kingSquare, addedPieces[i], addedSquares[i]);
+                if (feature >= 0) {
+                    added[addedCount++] = feature;
+                }
+            }
+        }
+        _network->update(parent, child, perspective, removed, removedCount, added, addedCount);
+    }
+}
 
-        _initedMagic = true;
+// bonus for a passed pawn by how far it has come, rank 2 to rank 7
+static const int passedBonus[8] = {
+    0, makeScore(5, 10), makeScore(10, 20), makeScore(15, 35), makeScore(25, 60), makeScore(40, 100), makeScore(60, 150), 0
+};
+constexpr int doubledPenalty = makeScore(-10, -20);
+constexpr int isolatedPenalty = makeScore(-10, -15);
 
-        std::cout << "initialized magic bitboards and bitboard lookup" << std::endl;
+void GameState::evaluatePawns(PawnEntry& entry) const
+{
+    const uint64_t pawns[2] = { _bitboards[WHITE_PAWNS].getData(), _bitboards[BLACK_PAWNS].getData() };
+    const uint64_t fileA = 0x0101010101010101ULL;
+    int score = 0;
+    for (int side = 0; side < 2; side++) {
+        const int sign = side == 0 ? 1 : -1;
+        const uint64_t own = pawns[side];
+        const uint64_t enemy = pawns[side ^ 1];
+        entry.passed[side] = 0;
+        for (int file = 0; file < 8; file++) {
+            const int onFile = countOnes(own & (fileA << file));
+            if (onFile > 1) {
+                score += sign * doubledPenalty * (onFile - 1);
+            }
+            if (onFile && !(own & _adjacentFiles[file])) {
+                score += sign * isolatedPenalty * onFile;
+            }
+        }
+        BitBoard(own).forEachBit([&](int square) {
+            // a pawn behind another of ours on the file isn't passed, the front one is
+            if (!(enemy & _passedMasks[side][square]) && !(own & _passedMasks[side][square] & (fileA << (square & 7)))) {
+                entry.passed[side] |= 1ULL << square;
+                const int rank = side == 0 ? square / 8 : 7 - square / 8;
+                score += sign * passedBonus[rank];
+            }
+        });
+    }
+    entry.key = pawnKey;
+    entry.score = score;
+}
+
+// the tables are laid out the way a board is printed, a8 first, from white's side.
+// black reads them mirrored and counts negative
+void GameState::initPieceSquareScores()
+{
+    struct PieceScores {
+        char piece;
+        int material;
+        const int* middlegame;
+        const int* endgame;
+        int phase;
+    };
+    static const PieceScores pieces[] = {
+        { 'P', 100, pawnTable, pawnEndgameTable, 0 },
+        { 'N', 200, knightTable, knightTable, 1 },
+        { 'B', 230, bishopTable, bishopTable, 1 },
+        { 'R', 400, rookTable, rookTable, 2 },
+        { 'Q', 900, queenTable, queenTable, 4 },
+        { 'K', 2000, kingTable, kingEndgameTable, 0 },
+    };
+
+    std::memset(_pieceSquareScores, 0, sizeof(_pieceSquareScores));
+    std::memset(_phaseWeights, 0, sizeof(_phaseWeights));
+    for (const PieceScores& scores : pieces) {
+        const unsigned char white = scores.piece;
+        const unsigned char black = scores.piece | 0x20;
+        for (int square = 0; square < 64; square++) {
+            const int whiteIndex = square ^ 56;
+            const int blackIndex = square;
+            _pieceSquareScores[white][square] = makeScore(scores.material + scores.middlegame[whiteIndex], scores.material + scores.endgame[whiteIndex]);
+            _pieceSquareScores[black][square] = -makeScore(scores.material + scores.middlegame[blackIndex], scores.material + scores.endgame[blackIndex]);
+        }
+        _phaseWeights[white] = scores.phase;
+        _phaseWeights[black] = scores.phase;
     }
 }
 
 void GameState::shutdown() {
-    cleanupMagicBitboards();
+    // the next init after a reset has to build the tables again
+    std::lock_guard<std::mutex> lock(_initMutex);
+    if (_initedMagic.load(std::memory_order_relaxed)) {
+        cleanupMagicBitboards();
+        _initedMagic.store(false, std::memory_order_release);
+    }
 }
 
-void GameState::addPawnBitboardMovesToList(std::vector<BitMove>& moves, const BitBoard bitboard, const int shift) {
+void GameState::addPawnBitboardMovesToList(MoveList& moves, const BitBoard bitboard, const int shift, const int flags) {
     if (bitboard.getData() == 0)
         return;
     bitboard.forEachBit([&](int toSquare) {
         int fromSquare = toSquare - shift; // Correct calculation for fromSquare
-        moves.emplace_back(fromSquare, toSquare, Pawn);
+        // reaching the last rank always promotes (to a queen, see pushMove)
+        int promotion = (toSquare >= 56 || toSquare < 8) ? IsPromotion : 0;
+        moves.add(fromSquare, toSquare, Pawn, flags | promotion);
     });
 }
 
-void GameState::generatePawnMoveList(std::vector<BitMove>& moves, const BitBoard pawns, const BitBoard emptySquares, const BitBoard enemyPieces, char color) {
+// a square index shift as a board shift, up the board for a positive amount
+template <int Shift>
+static inline uint64_t shifted(uint64_t board) {
+    if constexpr (Shift > 0) {
+        return board << Shift;
+    } else {
+        return board >> -Shift;
+    }
+}
+
+template <char Us>
+void GameState::generatePawnMoveList(MoveList& moves, const BitBoard pawns, const BitBoard emptySquares, const BitBoard enemyPieces, MoveGenType type, uint64_t targetMask) {
     if (pawns.getData() == 0)
         return;
 
-    BitBoard demoRight(NotAFile);
-    BitBoard demoLeft(NotHFile);
+    // square index steps towards the other side of the board
+    constexpr int shiftForward = Us == WHITE ? 8 : -8;
+    constexpr int doubleShift = 2 * shiftForward;
+    constexpr int captureLeftShift = Us == WHITE ? 7 : -9;
+    constexpr int captureRightShift = Us == WHITE ? 9 : -7;
+    // where a pawn lands after its first step from the starting rank
+    constexpr uint64_t firstStepRank = Us == WHITE ? Rank3 : Rank6;
 
     // Calculate single pawn moves forward
-    BitBoard singleMoves = (color == WHITE) ? (pawns.getData() << 8) & emptySquares.getData() : (pawns.getData() >> 8) & emptySquares.getData();
+    BitBoard singleMoves = shifted<shiftForward>(pawns.getData()) & emptySquares.getData();
     // Calculate double pawn moves from starting rank
-    BitBoard doubleMoves = (color == WHITE) ? ((singleMoves.getData() & Rank3) << 8) & emptySquares.getData() : ((singleMoves.getData() & Rank6) >> 8) & emptySquares.getData();
+    BitBoard doubleMoves = shifted<shiftForward>(singleMoves.getData() & firstStepRank) & emptySquares.getData();
     // Calculate left and right pawn captures
-    BitBoard capturesLeft = (color == WHITE) ? ((pawns.getData() & NotAFile) << 7) & enemyPieces.getData() : ((pawns.getData() & NotAFile) >> 9) & enemyPieces.getData();
-    BitBoard capturesRight = (color == WHITE) ? ((pawns.getData() & NotHFile) << 9) & enemyPieces.getData() : ((pawns.getData() & NotHFile) >> 7) & enemyPieces.getData();
+    BitBoard capturesLeft = shifted<captureLeftShift>(pawns.getData() & NotAFile) & enemyPieces.getData();
+    BitBoard capturesRight = shifted<captureRightShift>(pawns.getData() & NotHFile) & enemyPieces.getData();
 
-    int shiftForward = (color == WHITE) ? 8 : -8;
-    int doubleShift = (color == WHITE) ? 16 : -16;
-    int captureLeftShift = (color == WHITE) ? 7 : -9;
-    int captureRightShift = (color == WHITE) ? 9 : -7;
+    if (type == GenCaptures) {
+        // quiet pushes only count when they promote
+        singleMoves &= 0xFF000000000000FFULL;
+        doubleMoves = 0;
+    } else if (type == GenQuiets) {
+        singleMoves &= ~0xFF000000000000FFULL;
+        capturesLeft = 0;
+        capturesRight = 0;
+    }
+    // masked only now, a double push can block a check even when its first step can't
+    singleMoves &= targetMask;
+    doubleMoves &= targetMask;
+    capturesLeft &= targetMask;
+    capturesRight &= targetMask;
     
     // Add single pawn moves to the list
     addPawnBitboardMovesToList(moves, singleMoves, shiftForward);
@@ -90,62 +469,62 @@ void GameState::generatePawnMoveList(std::vector<BitMove>& moves, const BitBoard
     addPawnBitboardMovesToList(moves, doubleMoves, doubleShift);
 
     // Add pawn captures to the list
-    addPawnBitboardMovesToList(moves, capturesLeft, captureLeftShift);
-    addPawnBitboardMovesToList(moves, capturesRight, captureRightShift);
+    addPawnBitboardMovesToList(moves, capturesLeft, captureLeftShift, IsCapture);
+    addPawnBitboardMovesToList(moves, capturesRight, captureRightShift, IsCapture);
 }
 
 // Generate actual move objects from a bitboard
-void GameState::generateKnightMoves(std::vector<BitMove>& moves, BitBoard knightBoard, uint64_t occupancy) {
+void GameState::generateKnightMoves(MoveList& moves, BitBoard knightBoard, uint64_t targets) {
     knightBoard.forEachBit([&](int fromSquare) {
-        BitBoard moveBitboard = BitBoard(KnightAttacks[fromSquare] & occupancy);
+        BitBoard moveBitboard = BitBoard(KnightAttacks[fromSquare] & targets);
         // Efficiently iterate through only the set bits
         moveBitboard.forEachBit([&](int toSquare) {
-           moves.emplace_back(fromSquare, toSquare, Knight);
+           moves.add(fromSquare, toSquare, Knight, captureFlag(toSquare));
         });
     });
 }
 
 // Generate actual move objects from a bitboard
-void GameState::generateKingMoves(std::vector<BitMove>& moves, BitBoard piecesBoard, uint64_t occupancy) {
+void GameState::generateKingMoves(MoveList& moves, BitBoard piecesBoard, uint64_t targets) {
     piecesBoard.forEachBit([&](int fromSquare) {
-        BitBoard moveBitboard = BitBoard(KingAttacks[fromSquare] & occupancy);
+        BitBoard moveBitboard = BitBoard(KingAttacks[fromSquare] & targets);
         // Efficiently iterate through only the set bits
         moveBitboard.forEachBit([&](int toSquare) {
-           moves.emplace_back(fromSquare, toSquare, King);
+           moves.add(fromSquare, toSquare, King, captureFlag(toSquare));
         });
     });
 }
 
 // Generate actual move objects from a bitboard
-void GameState::generateBishopMoves(std::vector<BitMove>& moves, BitBoard piecesBoard, uint64_t occupancy, uint64_t friendlies)
+void GameState::generateBishopMoves(MoveList& moves, BitBoard piecesBoard, uint64_t occupancy, uint64_t targets)
 {
     piecesBoard.forEachBit([&](int fromSquare) {
-        BitBoard moveBitboard = BitBoard(getBishopAttacks(fromSquare, occupancy) & ~friendlies);
+        BitBoard moveBitboard = BitBoard(getBishopAttacks(fromSquare, occupancy) & targets);
         // Efficiently iterate through only the set bits
         moveBitboard.forEachBit([&](int toSquare) {
-           moves.emplace_back(fromSquare, toSquare, Bishop);
+           moves.add(fromSquare, toSquare, Bishop, captureFlag(toSquare));
         });
     });
 }
 
-void GameState::generateRooksMoves(std::vector<BitMove>& moves, BitBoard piecesBoard, uint64_t occupancy, uint64_t friendlies)
+void GameState::generateRooksMoves(MoveList& moves, BitBoard piecesBoard, uint64_t occupancy, uint64_t targets)
 {
     piecesBoard.forEachBit([&](int fromSquare) {
-        BitBoard moveBitboard = BitBoard(getRookAttacks(fromSquare, occupancy) & ~friendlies);
+        BitBoard moveBitboard = BitBoard(getRookAttacks(fromSquare, occupancy) & targets);
         // Efficiently iterate through only the set bits
         moveBitboard.forEachBit([&](int toSquare) {
-           moves.emplace_back(fromSquare, toSquare, Rook);
+           moves.add(fromSquare, toSquare, Rook, captureFlag(toSquare));
         });
     });
 }
 
-void GameState::generateQueensMoves(std::vector<BitMove>& moves, BitBoard piecesBoard, uint64_t occupancy, uint64_t friendlies)
+void GameState::generateQueensMoves(MoveList& moves, BitBoard piecesBoard, uint64_t occupancy, uint64_t targets)
 {
     piecesBoard.forEachBit([&](int fromSquare) {
-        BitBoard moveBitboard = BitBoard(getQueenAttacks(fromSquare, occupancy) & ~friendlies);
+        BitBoard moveBitboard = BitBoard(getQueenAttacks(fromSquare, occupancy) & targets);
         // Efficiently iterate through only the set bits
         moveBitboard.forEachBit([&](int toSquare) {
-           moves.emplace_back(fromSquare, toSquare, Queen);
+           moves.add(fromSquare, toSquare, Queen, captureFlag(toSquare));
         });
     });
 }
@@ -227,21 +606,22 @@ const BitBoard GameState::generatePawnAttacks(const BitBoard pawns, char color)
     return result;
 }
 
-// Returns true if 'square' is attacked by any piece belonging to 'attackerColor'
-bool GameState::isSquareAttacked(int square, char attackerColor, const BitBoard (&boards)[e_numBitboards]) {
-	const int pawnIdx   = (attackerColor == WHITE) ? WHITE_PAWNS : BLACK_PAWNS;
-	const int knightIdx = (attackerColor == WHITE) ? WHITE_KNIGHTS : BLACK_KNIGHTS;
-	const int bishopIdx = (attackerColor == WHITE) ? WHITE_BISHOPS : BLACK_BISHOPS;
-	const int rookIdx   = (attackerColor == WHITE) ? WHITE_ROOKS : BLACK_ROOKS;
-	const int queenIdx  = (attackerColor == WHITE) ? WHITE_QUEENS : BLACK_QUEENS;
-	const int kingIdx   = (attackerColor == WHITE) ? WHITE_KING : BLACK_KING;
+// Returns true if 'square' is attacked by any piece belonging to 'Attacker'
+template <char Attacker>
+bool GameState::isSquareAttacked(int square, const BitBoard (&boards)[e_numBitboards]) {
+	constexpr int base      = Attacker == WHITE ? WHITE_PAWNS : BLACK_PAWNS;
+	constexpr int pawnIdx   = base + WHITE_PAWNS;
+	constexpr int knightIdx = base + WHITE_KNIGHTS;
+	constexpr int bishopIdx = base + WHITE_BISHOPS;
+	constexpr int rookIdx   = base + WHITE_ROOKS;
+	constexpr int queenIdx  = base + WHITE_QUEENS;
+	constexpr int kingIdx   = base + WHITE_KING;
 
 	// Get Occupancy of all pieces for sliding checks
 	BitBoard occ = boards[OCCUPANCY];
 
-	// Check Pawn Attacks
-	char targetColor = (attackerColor == WHITE) ? BLACK : WHITE; 
-	if ((generatePawnAttacksBitBoard(square, targetColor) & boards[pawnIdx].getData()) != 0) return true;
+	// Check Pawn Attacks, a defending pawn on square would attack exactly the pawns attacking it
+	if ((_pawnAttacks[Attacker == WHITE ? 1 : 0][square].getData() & boards[pawnIdx].getData()) != 0) return true;
 
 	// Check Knight Attacks
 	if ((KnightAttacks[square] & boards[knightIdx].getData()) != 0) return true;
@@ -260,90 +640,116 @@ bool GameState::isSquareAttacked(int square, char attackerColor, const BitBoard
 	return false;
 }
 
-void GameState::filterOutIllegalMoves(std::vector<BitMove>& moves) {
-	if (moves.empty()) return;
-
+// plays the move on a copy of the bitboards and looks for attacks on our king
+bool GameState::leavesKingInCheck(const BitMove& move) {
 	const char myColor = color;
 	const char opponentColor = (color == WHITE) ? BLACK : WHITE;
 	const int myKingIdx = (myColor == WHITE) ? WHITE_KING : BLACK_KING;
 
-	// Remove moves that leave the king in check
-	moves.erase(std::remove_if(moves.begin(), moves.end(), [&](const BitMove& move) {
-		
-		// Create a temporary copy of the board state
-		BitBoard tempBoards[e_numBitboards];
-		for (int i = 0; i < e_numBitboards; ++i) tempBoards[i] = _bitboards[i];
-
-		// Apply the move to the temporary boards
-		// Note: We just need occupancy correct for check detection.
-		
-		const uint64_t fromMask = 1ULL << move.from;
-		const uint64_t toMask   = 1ULL << move.to;
-		
-		// Helper to determine which bitboard a piece belongs to
-		auto getPieceIdx = [&](ChessPiece p, char c) {
-			if (p == Pawn) return c == WHITE ? WHITE_PAWNS : BLACK_PAWNS;
-			if (p == Knight) return c == WHITE ? WHITE_KNIGHTS : BLACK_KNIGHTS;
-			if (p == Bishop) return c == WHITE ? WHITE_BISHOPS : BLACK_BISHOPS;
-			if (p == Rook) return c == WHITE ? WHITE_ROOKS : BLACK_ROOKS;
-			if (p == Queen) return c == WHITE ? WHITE_QUEENS : BLACK_QUEENS;
-			return c == WHITE ? WHITE_KING : BLACK_KING; // King
-		};
-
-		int moverIdx = getPieceIdx(static_cast<ChessPiece>(move.piece), myColor);
-		
-		// Remove from 'from'
-		tempBoards[moverIdx] &= ~fromMask;
-		tempBoards[OCCUPANCY] &= ~fromMask;
-
-		// Handle Captures (Remove opponent piece at 'to')
-		// We scan opponent boards to find what was captured (slower than lookup, but safe for generic bitboards)
-		int startOpp = (opponentColor == WHITE) ? WHITE_PAWNS : BLACK_PAWNS;
-		int endOpp   = (opponentColor == WHITE) ? WHITE_KING : BLACK_KING;
-		
-		// Specialized handling for En Passant
-		if (move.flags & EnPassant) {
-			int capSq = (myColor == WHITE) ? (move.to - 8) : (move.to + 8);
-			uint64_t capMask = 1ULL << capSq;
-			tempBoards[startOpp] &= ~capMask; // Opponent Pawns
-			tempBoards[OCCUPANCY] &= ~capMask;
-		} else {
-			// Standard capture
-			for (int i = startOpp; i <= endOpp; ++i) {
-				tempBoards[i] &= ~toMask;
-			}
-			tempBoards[OCCUPANCY] &= ~toMask; // Clear strictly to ensure no overlap before adding
-		}
+	// Create a temporary copy of the board state
+	BitBoard tempBoards[e_numBitboards];
+	for (int i = 0; i < e_numBitboards; ++i) tempBoards[i] = _bitboards[i];
 
-		// Handle Promotion
-		if ((move.flags & IsPromotion)) {
-			moverIdx = getPieceIdx(Queen, myColor); // Assume Queen promotion for check safety (mostly covers it)
-		}
+	// Apply the move to the temporary boards
+	// Note: We just need occupancy correct for check detection.
+	
+	const uint64_t fromMask = 1ULL << move.from;
+	const uint64_t toMask   = 1ULL << move.to;
+	
+	// Helper to determine which bitboard a piece belongs to
+	auto getPieceIdx = [&](ChessPiece p, char c) {
+		if (p == Pawn) return c == WHITE ? WHITE_PAWNS : BLACK_PAWNS;
+		if (p == Knight) return c == WHITE ? WHITE_KNIGHTS : BLACK_KNIGHTS;
+		if (p == Bishop) return c == WHITE ? WHITE_BISHOPS : BLACK_BISHOPS;
+		if (p == Rook) return c == WHITE ? WHITE_ROOKS : BLACK_ROOKS;
+		if (p == Queen) return c == WHITE ? WHITE_QUEENS : BLACK_QUEENS;
+		return c == WHITE ? WHITE_KING : BLACK_KING; // King
+	};
 
-		// Add to 'to'
-		tempBoards[moverIdx] |= toMask;
-		tempBoards[OCCUPANCY] |= toMask;
-
-		// Handle King Move (Update King Index tracking)
-		int currentKingSquare = -1;
-		if (move.piece == King) {
-			currentKingSquare = move.to;
-		} else {
-			// If king didn't move, find him
-			currentKingSquare = tempBoards[myKingIdx].firstBit();
+	int moverIdx = getPieceIdx(static_cast<ChessPiece>(move.piece), myColor);
+	
+	// Remove from 'from'
+	tempBoards[moverIdx] &= ~fromMask;
+	tempBoards[OCCUPANCY] &= ~fromMask;
+
+	// Handle Captures (Remove opponent piece at 'to')
+	// We scan opponent boards to find what was captured (slower than lookup, but safe for generic bitboards)
+	int startOpp = (opponentColor == WHITE) ? WHITE_PAWNS : BLACK_PAWNS;
+	int endOpp   = (opponentColor == WHITE) ? WHITE_KING : BLACK_KING;
+	
+	// Specialized handling for En Passant
+	if (move.flags & EnPassant) {
+		int capSq = (myColor == WHITE) ? (move.to - 8) : (move.to + 8);
+		uint64_t capMask = 1ULL << capSq;
+		tempBoards[startOpp] &= ~capMask; // Opponent Pawns
+		tempBoards[OCCUPANCY] &= ~capMask;
+	} else {
+		// Standard capture
+		for (int i = startOpp; i <= endOpp; ++i) {
+			tempBoards[i] &= ~toMask;
 		}
+		tempBoards[OCCUPANCY] &= ~toMask; // Clear strictly to ensure no overlap before adding
+	}
+
+	// Handle Promotion
+	if ((move.flags & IsPromotion)) {
+		moverIdx = getPieceIdx(Queen, myColor); // Assume Queen promotion for check safety (mostly covers it)
+	}
+
+	// Add to 'to'
+	tempBoards[moverIdx] |= toMask;
+	tempBoards[OCCUPANCY] |= toMask;
 
-		// If the King is attacked by the opponent after this move, the move is illegal.
-		return isSquareAttacked(currentKingSquare, opponentColor, tempBoards);
+	// Handle King Move (Update King Index tracking)
+	int currentKingSquare = -1;
+	if (move.piece == King) {
+		currentKingSquare = move.to;
+	} else {
+		// If king didn't move, find him
+		currentKingSquare = tempBoards[myKingIdx].firstBit();
+	}
 
-	}), moves.end());
+	// If the King is attacked by the opponent after this move, the move is illegal.
+	return opponentColor == WHITE ? isSquareAttacked<WHITE>(currentKingSquare, tempBoards) : isSquareAttacked<BLACK>(currentKingSquare, tempBoards);
+}
+
+void GameState::filterOutIllegalMoves(MoveList& moves) {
+	if (moves.empty()) return;
+
+	// Remove moves that leave the king in check
+	BitMove* legalEnd = std::remove_if(moves.begin(), moves.end(), [&](const BitMove& move) {
+		return leavesKingInCheck(move);
+	});
+	moves.count = static_cast<int>(legalEnd - moves.begin());
+}
+
+void GameState::generateAllMoves(MoveList& moves)
+{
+    moves.clear();
+    generateMoves(moves, GenAll);
+}
+
+void GameState::generateCaptureMoves(MoveList& moves)
+{
+    moves.clear();
+    generateMoves(moves, GenCaptures);
+}
+
+void GameState::generateQuietMoves(MoveList& moves)
+{
+    moves.clear();
+    generateMoves(moves, GenQuiets);
 }
 
 std::vector<BitMove> GameState::generateAllMoves()
 {
-    std::vector<BitMove> moves;
-    moves.reserve(32);
+    MoveList moves;
+    generateAllMoves(moves);
+    return std::vector<BitMove>(moves.begin(), moves.end());
+}
 
+void GameState::updateBitboards()
+{
     for (int i=0; i<e_numBitboards; i++) {
         _bitboards[i] = 0;
     }
@@ -362,19 +768,405 @@ std::vector<BitMove> GameState::generateAllMoves()
     _bitboards[BLACK_QUEENS].getData() | _bitboards[BLACK_KING].getData();
     
     _bitboards[OCCUPANCY] = _bitboards[WHITE_ALL_PIECES].getData() | _bitboards[BLACK_ALL_PIECES].getData();
+}
 
-    int bitIndex = color == WHITE ? WHITE_PAWNS : BLACK_PAWNS;
-    int oppBitIndex = color == WHITE ? BLACK_PAWNS : WHITE_PAWNS;
+bool GameState::evaluationMatchesState() const
+{
+    int score = 0;
+    int weight = 0;
+    for (int square = 0; square < 64; square++) {
+        score += _pieceSquareScores[(unsigned char)state[square]][square];
+        weight += _phaseWeights[(unsigned char)state[square]];
+    }
+    if (score != psqtScore || weight != phase) {
+        return false;
+    }
+    if (_network) {
+        NnueAccumulator refreshed;
+        _network->refresh(state, 0, refreshed);
+        _network->refresh(state, 1, refreshed);
+        return std::memcmp(&refreshed, &_accumulators[stackPtr], sizeof(refreshed)) == 0;
+    }
+    return true;
+}
+
+bool GameState::bitboardsMatchState() const
+{
+    GameState rebuilt;
+    std::memcpy(rebuilt.state, state, sizeof(state));
+    rebuilt.updateBitboards();
+    for (int i = 0; i < e_numBitboards; i++) {
+        if (rebuilt._bitboards[i].getData() != _bitboards[i].getData()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool GameState::isInCheck()
+{
+    const int kingIdx = color == WHITE ? WHITE_KING : BLACK_KING;
+    if (_bitboards[kingIdx].getData() == 0) {
+        return false;
+    }
+    const int kingSquare = _bitboards[kingIdx].firstBit();
+    return color == WHITE ? isSquareAttacked<BLACK>(kingSquare, _bitboards) : isSquareAttacked<WHITE>(kingSquare, _bitboards);
+}
+
+// anything besides pawns and the king, without it null move pruning runs into zugzwang
+bool GameState::hasNonPawnMaterial(char side) const
+{
+    const int base = side == WHITE ? WHITE_PAWNS : BLACK_PAWNS;
+    return (_bitboards[base + WHITE_KNIGHTS].getData() | _bitboards[base + WHITE_BISHOPS].getData() |
+            _bitboards[base + WHITE_ROOKS].getData() | _bitboards[base + WHITE_QUEENS].getData()) != 0;
+}
+
+template <char Attacker>
+uint64_t GameState::attackersTo(int square, uint64_t occupancy) const
+{
+    constexpr int base = Attacker == WHITE ? WHITE_PAWNS : BLACK_PAWNS;
+    const uint64_t diagonal = _bitboards[base + WHITE_BISHOPS].getData() | _bitboards[base + WHITE_QUEENS].getData();
+    const uint64_t straight = _bitboards[base + WHITE_ROOKS].getData() | _bitboards[base + WHITE_QUEENS].getData();
+    // a pawn of ours standing on square would attack exactly the enemy pawns that attack it
+    return (_pawnAttacks[Attacker == WHITE ? 1 : 0][square].getData() & _bitboards[base + WHITE_PAWNS].getData())
+        | (KnightAttacks[square] & _bitboards[base + WHITE_KNIGHTS].getData())
+        | (KingAttacks[square] & _bitboards[base + WHITE_KING].getData())
+        | (getBishopAttacks(square, occupancy) & diagonal)
+        | (getRookAttacks(square, occupancy) & straight);
+}
+
+uint64_t GameState::attackersTo(int square, char attackerColor, uint64_t occupancy) const
+{
+    return attackerColor == WHITE ? attackersTo<WHITE>(square, occupancy) : attackersTo<BLACK>(square, occupancy);
+}
+
+// the evaluation's material, by bitboard from pawns to king. the king's value only has to
+// be more than anything it could capture
+static const int seeValues[6] = { 100, 200, 230, 400, 900, 20000 };
+
+static int seeValue(unsigned char piece)
+{
+    switch (piece | 0x20) {  // lower case
+        case 'p': return seeValues[0];
+        case 'n': return seeValues[1];
+        case 'b': return seeValues[2];
+        case 'r': return seeValues[3];
+        case 'q': return seeValues[4];
+        case 'k': return seeValues[5];
+        default: return 0;
+    }
+}
+
+int GameState::see(const BitMove& move) const
+{
+    const int to = move.to;
+    const uint64_t diagonal = _bitboards[WHITE_BISHOPS].getData() | _bitboards[WHITE_QUEENS].getData()
+        | _bitboards[BLACK_BISHOPS].getData() | _bitboards[BLACK_QUEENS].getData();
+    const uint64_t straight = _bitboards[WHITE_ROOKS].getData() | _bitboards[WHITE_QUEENS].getData()
+        | _bitboards[BLACK_ROOKS].getData() | _bitboards[BLACK_QUEENS].getData();
+    uint64_t occupancy = _bitboards[OCCUPANCY].getData() ^ (1ULL << move.from);
 
-    generateKnightMoves(moves, _bitboards[WHITE_KNIGHTS + bitIndex], ~_bitboards[WHITE_ALL_PIECES + bitIndex].getData());
-    generatePawnMoveList(moves, _bitboards[WHITE_PAWNS  + bitIndex], ~_bitboards[OCCUPANCY].getData(), _bitboards[WHITE_ALL_PIECES + oppBitIndex].getData(), color);
-    generateKingMoves(moves, _bitboards[WHITE_KING + bitIndex], ~_bitboards[WHITE_ALL_PIECES + bitIndex].getData());
-    generateBishopMoves(moves, _bitboards[WHITE_BISHOPS + bitIndex], _bitboards[OCCUPANCY].getData(), _bitboards[WHITE_ALL_PIECES + bitIndex].getData());
-    generateRooksMoves(moves, _bitboards[WHITE_ROOKS + bitIndex], _bitboards[OCCUPANCY].getData(), _bitboards[WHITE_ALL_PIECES + bitIndex].getData());
-    generateQueensMoves(moves, _bitboards[WHITE_QUEENS + bitIndex], _bitboards[OCCUPANCY].getData(), _bitboards[WHITE_ALL_PIECES + bitIndex].getData());
+    // gain[d] is what the side making capture d is up once it is made, if the other side then stops
+    int gain[32];
+    gain[0] = seeValue(state[to]);
+    int onSquare = seeValue(state[move.from]);
+    if (move.flags & EnPassant) {
+        gain[0] = seeValues[0];
+        occupancy ^= 1ULL << (color == WHITE ? to - 8 : to + 8);
+    }
+    if (move.flags & IsPromotion) {
+        gain[0] += seeValues[4] - seeValues[0];
+        onSquare = seeValues[4];
+    }
+
+    uint64_t attackers = (attackersTo(to, WHITE, occupancy) | attackersTo(to, BLACK, occupancy)) & occupancy;
+    char side = -color;
+    int depth = 0;
+    while (depth < 31) {
+        const int base = side == WHITE ? WHITE_PAWNS : BLACK_PAWNS;
+        const uint64_t ours = attackers & _bitboards[base + WHITE_ALL_PIECES].getData();
+        if (!ours) {
+            break;
+        }
+        int type = 0;
+        while (!(ours & _bitboards[base + type].getData())) {
+            type++;
+        }
+        // the king can only take last, with anything still attacking the square it would be in check
+        if (type == WHITE_KING && (attackers & ~ours)) {
+            break;
+        }
+        depth++;
+        gain[depth] = onSquare - gain[depth - 1];
+        onSquare = seeValues[type];
+        const uint64_t capturer = ours & _bitboards[base + type].getData();
+        occupancy ^= capturer & (0 - capturer);
+        // whatever was lined up behind it can see the square now
+        if (type == WHITE_PAWNS || type == WHITE_BISHOPS || type == WHITE_QUEENS) {
+            attackers |= getBishopAttacks(to, occupancy) & diagonal;
+        }
+        if (type == WHITE_ROOKS || type == WHITE_QUEENS) {
+            attackers |= getRookAttacks(to, occupancy) & straight;
+        }
+        attackers &= occupancy;
+        side = -side;
+    }
+    // either side may stop recapturing when going on loses more
+    while (depth > 0) {
+        gain[depth - 1] = -std::max(-gain[depth - 1], gain[depth]);
+        depth--;
+    }
+    return gain[0];
+}
 
-    filterOutIllegalMoves(moves);
+template <char Us>
+uint64_t GameState::pinnedPieces(int kingSquare) const
+{
+    constexpr int ownBase = Us == WHITE ? WHITE_PAWNS : BLACK_PAWNS;
+    constexpr int enemyBase = Us == WHITE ? BLACK_PAWNS : WHITE_PAWNS;
+    const uint64_t enemies = _bitboards[enemyBase + WHITE_ALL_PIECES].getData();
+    const uint64_t diagonal = _bitboards[enemyBase + WHITE_BISHOPS].getData() | _bitboards[enemyBase + WHITE_QUEENS].getData();
+    const uint64_t straight = _bitboards[enemyBase + WHITE_ROOKS].getData() | _bitboards[enemyBase + WHITE_QUEENS].getData();
 
-    return moves;
+    // sliders that would see the king if none of our pieces were in the way
+    const uint64_t snipers = (getBishopAttacks(kingSquare, enemies) & diagonal) | (getRookAttacks(kingSquare, enemies) & straight);
+    uint64_t pinned = 0;
+    BitBoard(snipers).forEachBit([&](int sniper) {
+        const uint64_t blockers = _betweenMasks[kingSquare][sniper] & _bitboards[OCCUPANCY].getData();
+        if (blockers && !(blockers & (blockers - 1))) {
+            pinned |= blockers & _bitboards[ownBase + WHITE_ALL_PIECES].getData();
+        }
+    });
+    return pinned;
 }
 
+// legal moves straight from the generators. the checkers, the squares that answer a check and the
+// pinned pieces are worked out once, then every piece only gets the targets that keep the king safe.
+// en passant isn't generated, if it ever is it needs its own test: both pawns leave the king's rank
+void GameState::generateMoves(MoveList& moves, MoveGenType type)
+{
+    if (color == WHITE) {
+        generateMoves<WHITE>(moves, type);
+    } else {
+        generateMoves<BLACK>(moves, type);
+    }
+}
+
+// the side to move is a template parameter so its bitboard indexes and pawn directions are constants
+template <char Us>
+void GameState::generateMoves(MoveList& moves, MoveGenType type)
+{
+    constexpr char Them = Us == WHITE ? BLACK : WHITE;
+    constexpr int bitIndex = Us == WHITE ? WHITE_PAWNS : BLACK_PAWNS;
+    constexpr int oppBitIndex = Us == WHITE ? BLACK_PAWNS : WHITE_PAWNS;
+    const uint64_t king = _bitboards[WHITE_KING + bitIndex].getData();
+    if (!king) {
+        // only in positions set up by hand, there is nothing to keep safe
+        generatePseudoLegalMoves<Us>(moves, type);
+        return;
+    }
+    const int kingSquare = BitBoard(king).firstBit();
+    const uint64_t occupancy = _bitboards[OCCUPANCY].getData();
+
+    uint64_t targets = ~_bitboards[WHITE_ALL_PIECES + bitIndex].getData();
+    if (type == GenCaptures) {
+        targets = _bitboards[WHITE_ALL_PIECES + oppBitIndex].getData();
+    } else if (type == GenQuiets) {
+        targets = ~occupancy;
+    }
+
+    // the king can't stay on a checking slider's line either, so look through him
+    const uint64_t kingTargets = KingAttacks[kingSquare] & targets;
+    BitBoard(kingTargets).forEachBit([&](int toSquare) {
+        if (!attackersTo<Them>(toSquare, occupancy ^ king)) {
+            moves.add(kingSquare, toSquare, King, captureFlag(toSquare));
+        }
+    });
+
+    const uint64_t checkers = attackersTo<Them>(kingSquare, occupancy);
+    if (checkers & (checkers - 1)) {
+        // double check, only the king can move
+        return;
+    }
+    // in check everything else has to capture the checker or step in between
+    uint64_t checkMask = ~0ULL;
+    if (checkers) {
+        checkMask = checkers | _betweenMasks[kingSquare][BitBoard(checkers).firstBit()];
+    }
+    const uint64_t pinned = pinnedPieces<Us>(kingSquare);
+    const uint64_t pieceTargets = targets & checkMask;
+
+    // a pinned knight can never move
+    generateKnightMoves(moves, _bitboards[WHITE_KNIGHTS + bitIndex].getData() & ~pinned, pieceTargets);
+    generatePawnMoveList<Us>(moves, _bitboards[WHITE_PAWNS + bitIndex].getData() & ~pinned, ~occupancy, _bitboards[WHITE_ALL_PIECES + oppBitIndex].getData(), type, pieceTargets);
+    generateBishopMoves(moves, _bitboards[WHITE_BISHOPS + bitIndex].getData() & ~pinned, occupancy, pieceTargets);
+    generateRooksMoves(moves, _bitboards[WHITE_ROOKS + bitIndex].getData() & ~pinned, occupancy, pieceTargets);
+    generateQueensMoves(moves, _bitboards[WHITE_QUEENS + bitIndex].getData() & ~pinned, occupancy, pieceTargets);
+
+    // pinned pieces may still slide along the pin
+    BitBoard(pinned).forEachBit([&](int fromSquare) {
+        const BitBoard piece(1ULL << fromSquare);
+        const uint64_t pinTargets = pieceTargets & _lineMasks[kingSquare][fromSquare];
+        switch (state[fromSquare] | 0x20) {
+            case 'p': generatePawnMoveList<Us>(moves, piece, ~occupancy, _bitboards[WHITE_ALL_PIECES + oppBitIndex].getData(), type, pinTargets); break;
+            case 'b': generateBishopMoves(moves, piece, occupancy, pinTargets); break;
+            case 'r': generateRooksMoves(moves, piece, occupancy, pinTargets); break;
+            case 'q': generateQueensMoves(moves, piece, occupancy, pinTargets); break;
+            default: break;
+        }
+    });
+}
+
+// the old generator, every move a piece could make and then a board copy per move to throw
+// out the ones leaving the king in check. perft checks generateMoves against it
+void GameState::generatePseudoLegalMoves(MoveList& moves, MoveGenType type)
+{
+    if (color == WHITE) {
+        generatePseudoLegalMoves<WHITE>(moves, type);
+    } else {
+        generatePseudoLegalMoves<BLACK>(moves, type);
+    }
+}
+
+template <char Us>
+void GameState::generatePseudoLegalMoves(MoveList& moves, MoveGenType type)
+{
+    constexpr int bitIndex = Us == WHITE ? WHITE_PAWNS : BLACK_PAWNS;
+    constexpr int oppBitIndex = Us == WHITE ? BLACK_PAWNS : WHITE_PAWNS;
+
+    uint64_t targets = ~_bitboards[WHITE_ALL_PIECES + bitIndex].getData();
+    if (type == GenCaptures) {
+        targets = _bitboards[WHITE_ALL_PIECES + oppBitIndex].getData();
+    } else if (type == GenQuiets) {
+        targets = ~_bitboards[OCCUPANCY].getData();
+    }
+
+    generateKnightMoves(moves, _bitboards[WHITE_KNIGHTS + bitIndex], targets);
+    generatePawnMoveList<Us>(moves, _bitboards[WHITE_PAWNS  + bitIndex], ~_bitboards[OCCUPANCY].getData(), _bitboards[WHITE_ALL_PIECES + oppBitIndex].getData(), type);
+    generateKingMoves(moves, _bitboards[WHITE_KING + bitIndex], targets);
+    generateBishopMoves(moves, _bitboards[WHITE_BISHOPS + bitIndex], _bitboards[OCCUPANCY].getData(), targets);
+    generateRooksMoves(moves, _bitboards[WHITE_ROOKS + bitIndex], _bitboards[OCCUPANCY].getData(), targets);
+    generateQueensMoves(moves, _bitboards[WHITE_QUEENS + bitIndex], _bitboards[OCCUPANCY].getData(), targets);
+
+    if (_bitboards[WHITE_KING + bitIndex].getData()) {
+        filterOutIllegalMoves(moves);
+    }
+}
+
+uint64_t GameState::perft(int depth, bool useFilter)
+{
+    if (depth == 0) {
+        return 1;
+    }
+    MoveList moves;
+    if (useFilter) {
+        generatePseudoLegalMoves(moves, GenAll);
+    } else {
+        generateMoves(moves, GenAll);
+    }
+    if (depth == 1) {
+        return moves.size();
+    }
+    uint64_t nodes = 0;
+    for (const BitMove& move : moves) {
+        pushMove(move);
+        nodes += perft(depth - 1, useFilter);
+        popState();
+    }
+    return nodes;
+}
+
+bool GameState::verifyLegalMoves(int depth)
+{
+    MoveList legal;
+    MoveList filtered;
+    generateMoves(legal, GenAll);
+    generatePseudoLegalMoves(filtered, GenAll);
+
+    auto order = [](const BitMove& a, const BitMove& b) {
+        return std::tie(a.from, a.to, a.piece, a.flags) < std::tie(b.from, b.to, b.piece, b.flags);
+    };
+    std::sort(legal.begin(), legal.end(), order);
+    std::sort(filtered.begin(), filtered.end(), order);
+    if (!std::equal(legal.begin(), legal.end(), filtered.begin(), filtered.end())) {
+        std::cout << "move generation differs in " << std::string(state, 64) << (color == WHITE ? " white" : " black")
+                  << " to move: " << legal.size() << " legal, " << filtered.size() << " filtered" << std::endl;
+        return false;
+    }
+    if (depth <= 1) {
+        return true;
+    }
+    for (const BitMove& move : legal) {
+        pushMove(move);
+        const bool same = verifyLegalMoves(depth - 1);
+        popState();
+        if (!same) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static ChessPiece pieceType(char piece)
+{
+    switch (piece | 0x20) {  // lower case
+        case 'p': return Pawn;
+        case 'n': return Knight;
+        case 'b': return Bishop;
+        case 'r': return Rook;
+        case 'q': return Queen;
+        case 'k': return King;
+        default: return NoPiece;
+    }
+}
+
+bool GameState::isPseudoLegal(const BitMove& move) const
+{
+    // the generators never produce these, so neither can a move we stored earlier
+    if (move.from == move.to || move.from > 63 || move.to > 63 || (move.flags & (EnPassant | KingSideCastle | QueenSideCastle))) {
+        return false;
+    }
+    const char piece = state[move.from];
+    if (piece == '0' || (piece < 'a') != (color == WHITE) || pieceType(piece) != move.piece) {
+        return false;
+    }
+    const char target = state[move.to];
+    if (target != '0' && (target < 'a') == (color == WHITE)) {
+        return false;
+    }
+    if ((move.flags & IsCapture) != (target != '0' ? IsCapture : 0)) {
+        return false;
+    }
+    const bool lastRank = move.to >= 56 || move.to < 8;
+    if ((move.flags & IsPromotion) != (move.piece == Pawn && lastRank ? IsPromotion : 0)) {
+        return false;
+    }
+
+    const uint64_t toMask = 1ULL << move.to;
+    const uint64_t occupancy = _bitboards[OCCUPANCY].getData();
+    switch (move.piece) {
+        case Pawn: {
+            const int forward = color == WHITE ? 8 : -8;
+            if (target != '0') {
+                const int fileDistance = (move.to & 7) - (move.from & 7);
+                return (fileDistance == 1 || fileDistance == -1) && move.to - move.from - fileDistance == forward;
+            }
+            if (move.to == move.from + forward) {
+                return true;
+            }
+            const bool startRank = color == WHITE ? (move.from >> 3) == 1 : (move.from >> 3) == 6;
+            return startRank && move.to == move.from + 2 * forward && state[move.from + forward] == '0';
+        }
+        case Knight: return (KnightAttacks[move.from] & toMask) != 0;
+        case Bishop: return (getBishopAttacks(move.from, occupancy) & toMask) != 0;
+        case Rook: return (getRookAttacks(move.from, occupancy) & toMask) != 0;
+        case Queen: return (getQueenAttacks(move.from, occupancy) & toMask) != 0;
+        case King: return (KingAttacks[move.from] & toMask) != 0;
+        default: return false;
+    }
+}
+
+bool GameState::isLegal(const BitMove& move)
+{
+    return isPseudoLegal(move) && !leavesKingInCheck(move);
+}
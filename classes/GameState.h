@@ -6,6 +6,8 @@
 #include <cstdint>
 #include <vector>
 #include "Bitboard.h"
+#include "Nnue.h"
+#include "PawnHashTable.h"
 
 constexpr int WHITE = +1;
 constexpr int BLACK = -1;
@@ -46,6 +48,34 @@ enum MoveFlags {
     IsPromotion = 0x10 // 0001 0000
 };
 
+// GameStateData::flags, cleared again by every real move
+enum StateFlags {
+    NullMovePlayed = 0x01
+};
+
+// which moves generateMoves produces, the staged move picker asks for them separately
+enum MoveGenType {
+    GenAll,
+    GenCaptures,    // captures and promotions
+    GenQuiets       // everything GenCaptures leaves out
+};
+
+// middlegame and endgame score packed in one int, mg in the low 16 bits. sums of packed
+// scores stay packed as long as both halves fit in 16 bits
+constexpr int makeScore(int mg, int eg) { return static_cast<int>(static_cast<unsigned int>(eg) << 16) + mg; }
+inline int mgScore(int score) { return static_cast<int16_t>(static_cast<uint16_t>(score)); }
+inline int egScore(int score) { return static_cast<int16_t>(static_cast<uint16_t>(static_cast<unsigned int>(score + 0x8000) >> 16)); }
+// game phase with all minor and major pieces on the board, it counts down to 0 in a pawn ending
+constexpr int maxPhase = 24;
+
+enum CastlingRights {
+    WhiteKingSide = 0x01,
+    WhiteQueenSide = 0x02,
+    BlackKingSide = 0x04,
+    BlackQueenSide = 0x08,
+    AllCastlingRights = 0x0F
+};
+
 #pragma pack(push, 1)
 struct BitMove {
     unsigned char from;
@@ -67,26 +97,86 @@ struct BitMove {
 };
 #pragma pack(pop)
 
+// fixed capacity move list for the search, lives on the stack so generating moves at a
+// node never touches the allocator. every move has a slot for its move ordering score
+struct MoveList {
+    static constexpr int capacity = 256;    // no legal position has more than 218 moves
+
+    BitMove moves[capacity];
+    int scores[capacity];
+    int count = 0;
+
+    inline void add(int from, int to, ChessPiece piece, int flags) {
+        assert(count < capacity);
+        moves[count++] = BitMove(from, to, piece, flags);
+    }
+    inline void add(const BitMove& move) {
+        assert(count < capacity);
+        moves[count++] = move;
+    }
+    inline void swap(size_t a, size_t b) {
+        std::swap(moves[a], moves[b]);
+        std::swap(scores[a], scores[b]);
+    }
+    size_t size() const { return static_cast<size_t>(count); }
+    bool empty() const { return count == 0; }
+    void clear() { count = 0; }
+    BitMove& operator[](size_t index) { return moves[index]; }
+    const BitMove& operator[](size_t index) const { return moves[index]; }
+    BitMove* begin() { return moves; }
+    BitMove* end() { return moves + count; }
+    const BitMove* begin() const { return moves; }
+    const BitMove* end() const { return moves + count; }
+};
+
 struct alignas(32) GameStateData {
     char state[64];                 // persisitent
-    int flags;
+    int flags;                      // always zero after a move, which also terminates state as a C string
     char color;                     // BLACK or WHITE
+    unsigned char castling;         // CastlingRights still available
+    signed char enPassantSquare;    // square behind a pawn that just double pushed, -1 if none
+    unsigned char halfmoveClock;    // moves since the last capture or pawn move
+    uint64_t _zobristHash[2];       // [0] is the position key, [1] the same position with the other side to move
+    uint64_t pawnKey;               // key of the pawns alone, for the pawn hash
+    BitBoard _bitboards[e_numBitboards];    // the same position as state, pushMove updates both
+    int psqtScore;                  // packed material and piece square score, white minus black
+    int phase;                      // sum of the pieces' phase weights
 
     GameStateData() : flags(0)
-        , color(WHITE) {
+        , color(WHITE)
+        , castling(0)
+        , enPassantSquare(-1)
+        , halfmoveClock(0)
+        , psqtScore(0)
+        , phase(0) {
         std::memset(state, '0', sizeof(state));
+        _zobristHash[0] = 0;
+        _zobristHash[1] = 0;
+        pawnKey = 0;
+        _bitboards[EMPTY_SQUARES] = ~0ULL;
     }
     GameStateData(const GameStateData&) = default;
     GameStateData& operator=(const GameStateData&) = default;
 };
 
+// what popState needs to take a move back that the move itself doesn't say
+struct UndoRecord {
+    BitMove move;                   // from == to for a null move
+    unsigned char captured;         // what was on the target square, '0' if nothing
+    unsigned char castling;
+    signed char enPassantSquare;
+    unsigned char halfmoveClock;
+    int flags;
+    uint64_t hash;
+};
+
 class GameState : public GameStateData {
 public:
-    GameStateData stateStack[MAX_DEPTH];
+    // one record per move played since init, grows as needed so the depth is only limited
+    // by the search's own tables
+    std::vector<UndoRecord> undoStack;
     int stackPtr = 0;
 
-    uint64_t _zobristHash[2]; // when one hash value is made, the other is made as well because it's just a xor of the first by the color bit
-    BitBoard _bitboards[e_numBitboards];
     BitBoard _attackBitBoard;
 
     GameState() : stackPtr(0) { }
@@ -94,55 +184,318 @@ public:
     void init(const char* newState, char player);
 
     inline void pushMove(const BitMove& move) {
-        pushState();
+        uint64_t hash = _zobristHash[0];
         unsigned char fromPiece = state[move.from];
-        state[move.from] = '0';
-        state[move.to] = fromPiece;
+        unsigned char toPiece = state[move.to];
+        pushUndo(move, toPiece);
+        // the empty square rows of the key table are zero so captures don't need a branch
+        hash ^= _zobristPieces[fromPiece][move.from] ^ _zobristPieces[toPiece][move.to] ^ _zobristPieces[fromPiece][move.to];
+        setSquare(move.from, '0');
+        setSquare(move.to, fromPiece);
         if (move.flags & KingSideCastle) {
-            state[move.to - 1] = state[move.to + 1];
-            state[move.to + 1] = '0';
+            unsigned char rook = state[move.to + 1];
+            hash ^= _zobristPieces[rook][move.to + 1] ^ _zobristPieces[rook][move.to - 1];
+            setSquare(move.to - 1, rook);
+            setSquare(move.to + 1, '0');
         } else if (move.flags & QueenSideCastle) {
-            state[move.to + 1] = state[move.to - 2];
-            state[move.to - 2] = '0';
+            unsigned char rook = state[move.to - 2];
+            hash ^= _zobristPieces[rook][move.to - 2] ^ _zobristPieces[rook][move.to + 1];
+            setSquare(move.to + 1, rook);
+            setSquare(move.to - 2, '0');
         } else if (move.flags & EnPassant) {
             // check for color to determine which direction to capture
-            if (fromPiece == 'P') {
-                state[move.to - 8] = '0';
-            } else {
-                state[move.to + 8] = '0';
-            }
+            int capturedSquare = fromPiece == 'P' ? move.to - 8 : move.to + 8;
+            hash ^= _zobristPieces[(unsigned char)state[capturedSquare]][capturedSquare];
+            setSquare(capturedSquare, '0');
         } else if (move.flags & IsPromotion) {
-            state[move.to] = color == WHITE ? 'Q' : 'q';
+            unsigned char queen = color == WHITE ? 'Q' : 'q';
+            hash ^= _zobristPieces[fromPiece][move.to] ^ _zobristPieces[queen][move.to];
+            setSquare(move.to, queen);
+        }
+
+        // moving a king or rook, or capturing a rook, loses the matching castling rights
+        if (castling) {
+            hash ^= _zobristCastling[castling];
+            castling &= _castlingMask[move.from] & _castlingMask[move.to];
+            hash ^= _zobristCastling[castling];
         }
+
+        if (enPassantSquare >= 0) {
+            hash ^= _zobristEnPassant[enPassantSquare & 7];
+        }
+        enPassantSquare = -1;
+        if ((fromPiece == 'P' || fromPiece == 'p') && (move.to - move.from == 16 || move.from - move.to == 16)) {
+            // only remember the square when an enemy pawn could actually take en passant,
+            // otherwise identical positions would end up with different keys
+            unsigned char enemyPawn = fromPiece == 'P' ? 'p' : 'P';
+            int file = move.to & 7;
+            if ((file > 0 && state[move.to - 1] == enemyPawn) || (file < 7 && state[move.to + 1] == enemyPawn)) {
+                enPassantSquare = (move.from + move.to) / 2;
+                hash ^= _zobristEnPassant[file];
+            }
+        }
+
         // flip the color bit as it now becomes the other player's turn
         color = (color == WHITE) ? BLACK : WHITE;
+        hash ^= _zobristSide;
+        _zobristHash[0] = hash;
+        _zobristHash[1] = hash ^ _zobristSide;
         flags = 0; // invalidate all the flags
+        if (fromPiece == 'P' || fromPiece == 'p' || toPiece != '0') {
+            halfmoveClock = 0;
+        } else if (halfmoveClock < 255) {
+            halfmoveClock++;
+        }
+        if (_network) {
+            updateAccumulator();
+        }
+#if defined(ZOBRIST_DEBUG)
+        assert(_zobristHash[0] == computeZobristHash());
+        assert(pawnKey == computePawnKey());
+#endif
+#if defined(BITBOARD_DEBUG)
+        assert(bitboardsMatchState());
+#endif
+#if defined(EVAL_DEBUG)
+        assert(evaluationMatchesState());
+#endif
     }
 
-    inline void pushState() {
-        assert(stackPtr < MAX_DEPTH);
-        stateStack[stackPtr++] = static_cast<const GameStateData&>(*this);
+    // pass the turn without moving, for null move pruning
+    inline void pushNullMove() {
+        pushUndo(BitMove(), '0');
+        uint64_t hash = _zobristHash[0];
+        if (enPassantSquare >= 0) {
+            hash ^= _zobristEnPassant[enPassantSquare & 7];
+            enPassantSquare = -1;
+        }
+        color = (color == WHITE) ? BLACK : WHITE;
+        hash ^= _zobristSide;
+        _zobristHash[0] = hash;
+        _zobristHash[1] = hash ^ _zobristSide;
+        flags = NullMovePlayed;
+        // nothing before a null move can repeat after it
+        halfmoveClock = 0;
+        if (_network) {
+            NnueAccumulator& accumulator = pushAccumulator();
+            accumulator = _accumulators[stackPtr - 1];
+        }
+    }
+
+    inline void pushUndo(const BitMove& move, unsigned char captured) {
+        if (stackPtr == static_cast<int>(undoStack.size())) {
+            undoStack.emplace_back();
+        }
+        UndoRecord& undo = undoStack[stackPtr++];
+        undo.move = move;
+        undo.captured = captured;
+        undo.castling = castling;
+        undo.enPassantSquare = enPassantSquare;
+        undo.halfmoveClock = halfmoveClock;
+        undo.flags = flags;
+        undo.hash = _zobristHash[0];
     }
+
+    // takes back the last pushMove or pushNullMove
     inline void popState() {
         assert(stackPtr > 0);
-        static_cast<GameStateData&>(*this) = stateStack[--stackPtr];
+        const UndoRecord& undo = undoStack[--stackPtr];
+        const BitMove& move = undo.move;
+        color = (color == WHITE) ? BLACK : WHITE;
+        if (move.from != move.to) {
+            const unsigned char pawn = color == WHITE ? 'P' : 'p';
+            const unsigned char mover = (move.flags & IsPromotion) ? pawn : state[move.to];
+            setSquare(move.to, undo.captured);
+            setSquare(move.from, mover);
+            if (move.flags & KingSideCastle) {
+                setSquare(move.to + 1, state[move.to - 1]);
+                setSquare(move.to - 1, '0');
+            } else if (move.flags & QueenSideCastle) {
+                setSquare(move.to - 2, state[move.to + 1]);
+                setSquare(move.to + 1, '0');
+            } else if (move.flags & EnPassant) {
+                setSquare(color == WHITE ? move.to - 8 : move.to + 8, color == WHITE ? 'p' : 'P');
+            }
+        }
+        castling = undo.castling;
+        enPassantSquare = undo.enPassantSquare;
+        halfmoveClock = undo.halfmoveClock;
+        flags = undo.flags;
+        _zobristHash[0] = undo.hash;
+        _zobristHash[1] = undo.hash ^ _zobristSide;
+#if defined(ZOBRIST_DEBUG)
+        assert(_zobristHash[0] == computeZobristHash());
+        assert(pawnKey == computePawnKey());
+#endif
+#if defined(BITBOARD_DEBUG)
+        assert(bitboardsMatchState());
+#endif
+#if defined(EVAL_DEBUG)
+        assert(evaluationMatchesState());
+#endif
+    }
+
+    inline uint64_t hash() const { return _zobristHash[0]; }
+    // keys of the game's positions before this one, oldest first and back to the last capture
+    // or pawn move, so repetitions that started before the search can be seen. call after init
+    void setHistory(const std::vector<uint64_t>& keys);
+    // the current position was seen before since the last irreversible move. once is enough
+    // inside the search, before its root it takes two more for the threefold repetition
+    bool isRepetition() const;
+    // repetition or fifty moves without a capture or pawn move
+    inline bool isDraw() const { return halfmoveClock >= 100 || isRepetition(); }
+    // material and piece squares from white's side, kept up to date by pushMove so a leaf costs nothing.
+    // with a network set it is asked instead, its accumulator is kept up to date the same way
+    inline int evaluate() const {
+        if (_network) {
+            return _network->evaluate(_accumulators[stackPtr], color) * color;
+        }
+        return taperScore(psqtScore, phase);
+    }
+    // the same plus the pawn structure, which comes from the pawn hash when it can.
+    // the network has its own idea of pawns, it ignores the table
+    inline int evaluate(PawnHashTable& pawns) const {
+        if (_network) {
+            return evaluate();
+        }
+        bool hit;
+        PawnEntry& entry = pawns.probe(pawnKey, hit);
+        if (!hit) {
+            evaluatePawns(entry);
+        }
+#if defined(EVAL_DEBUG)
+        PawnEntry fresh;
+        evaluatePawns(fresh);
+        assert(fresh.score == entry.score && fresh.passed[0] == entry.passed[0] && fresh.passed[1] == entry.passed[1]);
+#endif
+        return taperScore(psqtScore + entry.score, phase);
     }
+    // fills in entry for the current pawns
+    void evaluatePawns(PawnEntry& entry) const;
+    // nullptr goes back to the piece square tables. the accumulator is only built for the
+    // current position, so set it at the root before searching
+    void setNetwork(const Nnue* network);
+    const Nnue* network() const { return _network; }
+    // blends the packed score from middlegame to endgame as pieces come off
+    static inline int taperScore(int score, int phase) {
+        phase = phase < maxPhase ? phase : maxPhase;
+        return (mgScore(score) * phase + egScore(score) * (maxPhase - phase)) / maxPhase;
+    }
+    static inline int pieceSquareScore(unsigned char piece, int square) { return _pieceSquareScores[piece][square]; }
+    static inline int phaseWeight(unsigned char piece) { return _phaseWeights[piece]; }
+    // the raw tables, [128][64] and [128], for evaluators that gather from them
+    static inline const int* pieceSquareTable() { return &_pieceSquareScores[0][0]; }
+    static inline const int* phaseWeightTable() { return _phaseWeights; }
+    // full recompute of the position key, pushMove keeps it up to date incrementally
+    uint64_t computeZobristHash() const;
+    uint64_t computePawnKey() const;
 
+    void generateAllMoves(MoveList& moves);
+    // captures and promotions only, for the quiescence search
+    void generateCaptureMoves(MoveList& moves);
+    // the rest, non capturing moves that don't promote
+    void generateQuietMoves(MoveList& moves);
+    // same as above in a vector, for the GUI and the root of the search
     std::vector<BitMove> generateAllMoves();
+    // rebuilds _bitboards from state, init does this and pushMove keeps them up to date after
+    void updateBitboards();
+    // true if _bitboards and state describe the same position
+    bool bitboardsMatchState() const;
+    // true if psqtScore and phase are what a full scan of state gives, and the network's
+    // accumulator too if there is one
+    bool evaluationMatchesState() const;
+    bool isInCheck();
+    bool hasNonPawnMaterial(char side) const;
+    // static exchange evaluation, the material the side to move ends up with if both sides keep
+    // recapturing on the target square with their cheapest piece for as long as it pays.
+    // sliders lined up behind a capturer join in once it has gone
+    int see(const BitMove& move) const;
+    // for moves that didn't come from the generator (hash moves, killers).
+    // pseudo legal is the same test the generators apply, legal also keeps the king safe
+    bool isPseudoLegal(const BitMove& move) const;
+    bool isLegal(const BitMove& move);
+    // leaf count of the move tree, with useFilter the moves come from the old generator that
+    // tries every pseudo legal move on a board copy. the two have to agree
+    uint64_t perft(int depth, bool useFilter = false);
+    // compares both generators move for move at every node down to depth, prints the first difference
+    bool verifyLegalMoves(int depth);
     void shutdown();
 private:
+    static void initZobristKeys();
+    static void initPieceSquareScores();
+    // these pick the side to move's instance of the templates below
+    void generateMoves(MoveList& moves, MoveGenType type);
+    void generatePseudoLegalMoves(MoveList& moves, MoveGenType type);
+    template <char Us> void generateMoves(MoveList& moves, MoveGenType type);
+    template <char Us> void generatePseudoLegalMoves(MoveList& moves, MoveGenType type);
+    // indexed by piece character, the '0' row stays zero so empty squares hash to nothing
+    static uint64_t _zobristPieces[128][64];
+    static uint64_t _zobristCastling[16];
+    static uint64_t _zobristEnPassant[8];
+    static uint64_t _zobristSide;
+    static unsigned char _castlingMask[64];
+    // piece character to its bitboard, and to the board of its side. an empty square's side board
+    // is OCCUPANCY, so one xor of each covers every change a square can go through
+    static unsigned char _bitboardLookup[128];
+    static unsigned char _sideLookup[128];
+    // all ones for the pawns, so setSquare only moves their keys into pawnKey
+    static uint64_t _pawnKeyMask[128];
+    // packed score of a piece character on a square, negative for black, zero for the empty square
+    static int _pieceSquareScores[128][64];
+    static int _phaseWeights[128];
+
+    // what setHistory was given, undoStack's hashes continue it from the root on
+    std::vector<uint64_t> _history;
+
+    // one accumulator per ply like undoStack, popState just goes back to the previous one
+    const Nnue* _network = nullptr;
+    std::vector<NnueAccumulator> _accumulators;
+    NnueAccumulator& pushAccumulator() {
+        if (stackPtr >= static_cast<int>(_accumulators.size())) {
+            _accumulators.resize(stackPtr + 1);
+        }
+        return _accumulators[stackPtr];
+    }
+    void refreshAccumulator();
+    // the network's half of pushMove, works out what changed from the last undo record
+    void updateAccumulator();
+
+    inline void setSquare(int square, unsigned char piece) {
+        const uint64_t mask = 1ULL << square;
+        const unsigned char old = state[square];
+        _bitboards[_bitboardLookup[old]] ^= mask;
+        _bitboards[_sideLookup[old]] ^= mask;
+        _bitboards[_bitboardLookup[piece]] ^= mask;
+        _bitboards[_sideLookup[piece]] ^= mask;
+        pawnKey ^= (_zobristPieces[old][square] & _pawnKeyMask[old]) ^ (_zobristPieces[piece][square] & _pawnKeyMask[piece]);
+        psqtScore += _pieceSquareScores[piece][square] - _pieceSquareScores[old][square];
+        phase += _phaseWeights[piece] - _phaseWeights[old];
+        state[square] = piece;
+    }
+
     const BitBoard generatePawnAttacks(const BitBoard pawns, char color);
     uint64_t generatePawnAttacksBitBoard(int square, char color);
     
-    void generateKnightMoves(std::vector<BitMove>& moves, BitBoard knightBoard, uint64_t occupancy);
-    void generateKingMoves(std::vector<BitMove>& moves, BitBoard kingBoard, uint64_t occupancy);
-    void generateRooksMoves(std::vector<BitMove>& moves, BitBoard bishopBoard, uint64_t occupancy, uint64_t friendlies);
-    void generateQueensMoves(std::vector<BitMove>& moves, BitBoard bishopBoard, uint64_t occupancy, uint64_t friendlies);
-
-    void generateBishopMoves(std::vector<BitMove>& moves, BitBoard bishopBoard, uint64_t occupancy, uint64_t friendlies);
-    void generatePawnMoveList(std::vector<BitMove>& moves, const BitBoard pawns, const BitBoard emptySquares, const BitBoard enemyPieces, char color);
-    void addPawnBitboardMovesToList(std::vector<BitMove>& moves, const BitBoard bitboard, const int shift);
-    bool isSquareAttacked(int square, char attackerColor, const BitBoard (&boards)[e_numBitboards]);
-    void filterOutIllegalMoves(std::vector<BitMove>& moves);
+    // targets is every square a piece may land on, ~friendlies for all moves or the enemy pieces for captures
+    void generateKnightMoves(MoveList& moves, BitBoard knightBoard, uint64_t targets);
+    void generateKingMoves(MoveList& moves, BitBoard kingBoard, uint64_t targets);
+    void generateRooksMoves(MoveList& moves, BitBoard bishopBoard, uint64_t occupancy, uint64_t targets);
+    void generateQueensMoves(MoveList& moves, BitBoard bishopBoard, uint64_t occupancy, uint64_t targets);
+
+    void generateBishopMoves(MoveList& moves, BitBoard bishopBoard, uint64_t occupancy, uint64_t targets);
+    inline int captureFlag(int toSquare) const { return (_bitboards[OCCUPANCY].getData() >> toSquare) & 1 ? IsCapture : 0; }
+    // targetMask limits where the pawns may land, for check evasions and pins
+    template <char Us>
+    void generatePawnMoveList(MoveList& moves, const BitBoard pawns, const BitBoard emptySquares, const BitBoard enemyPieces, MoveGenType type = GenAll, uint64_t targetMask = ~0ULL);
+    void addPawnBitboardMovesToList(MoveList& moves, const BitBoard bitboard, const int shift, const int flags = 0);
+    template <char Attacker>
+    bool isSquareAttacked(int square, const BitBoard (&boards)[e_numBitboards]);
+    // pieces of attackerColor attacking square, sliders see through to the given occupancy
+    uint64_t attackersTo(int square, char attackerColor, uint64_t occupancy) const;
+    template <char Attacker> uint64_t attackersTo(int square, uint64_t occupancy) const;
+    // our pieces that are the only thing between our king and an enemy slider
+    template <char Us> uint64_t pinnedPieces(int kingSquare) const;
+    bool leavesKingInCheck(const BitMove& move);
+    void filterOutIllegalMoves(MoveList& moves);
 
 };
@@ -0,0 +1,188 @@
+#include "MovePicker.h"
+
+static int mvvLvaValue(char piece)
+{
+    switch (piece | 0x20) {  // lower case
+        case 'p': return 1;
+        case 'n': return 2;
+        case 'b': return 3;
+        case 'r': return 4;
+        case 'q': return 5;
+        case 'k': return 6;
+        default: return 0;
+    }
+}
+
+static bool isEmptyMove(const BitMove& move)
+{
+    return move.from == move.to;
+}
+
+static bool isQuiet(const BitMove& move)
+{
+    return !(move.flags & (IsCapture | EnPassant | IsPromotion));
+}
+
+MovePicker::MovePicker(GameState& position, const BitMove& pvMove, const BitMove& ttMove,
+                       const BitMove (&killers)[2], const int (&history)[64][64])
+    : _position(position), _stage(HashMoves), _capturesOnly(false), _history(history)
+{
+    // still following last iteration's principal variation, then the table's best move
+    if (!isEmptyMove(pvMove)) {
+        _hashMoves[_hashCount++] = pvMove;
+    }
+    if (!isEmptyMove(ttMove) && !isHashMove(ttMove)) {
+        _hashMoves[_hashCount++] = ttMove;
+    }
+    for (const BitMove& killer : killers) {
+        if (!isEmptyMove(killer) && isQuiet(killer) && !isHashMove(killer)) {
+            _killers[_killerCount++] = killer;
+        }
+    }
+}
+
+MovePicker::MovePicker(GameState& position)
+    : _position(position), _stage(GenerateCaptures), _capturesOnly(true)
+{
+}
+
+bool MovePicker::isHashMove(const BitMove& move) const
+{
+    for (int i = 0; i < _hashCount; i++) {
+        if (move == _hashMoves[i]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool MovePicker::isKiller(const BitMove& move) const
+{
+    for (int i = 0; i < _killerCount; i++) {
+        if (move == _killers[i]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void MovePicker::pickBest(MoveList& moves)
+{
+    int best = _index;
+    for (int i = _index + 1; i < moves.count; i++) {
+        if (moves.scores[i] > moves.scores[best]) {
+            best = i;
+        }
+    }
+    if (best != _index) {
+        moves.swap(_index, best);
+    }
+}
+
+bool MovePicker::next(BitMove& move)
+{
+    while (true) {
+        switch (_stage) {
+            case HashMoves:
+                // a hash move comes from another position if the key collided, so it has to be legal here
+                while (_index < _hashCount) {
+                    move = _hashMoves[_index++];
+                    if (_position.isLegal(move)) {
+                        return true;
+                    }
+                }
+                _stage = GenerateCaptures;
+                break;
+
+            case GenerateCaptures: {
+                _position.generateCaptureMoves(_moves);
+                _badCaptures.clear();
+                // most valuable victim first, cheapest attacker breaks ties. only a capture by
+                // something worth more than its victim can lose material, those go through SEE
+                int kept = 0;
+                for (int i = 0; i < _moves.count; i++) {
+                    const BitMove capture = _moves[i];
+                    const char victim = _position.state[capture.to];
+                    const int victimValue = victim != '0' ? mvvLvaValue(victim) : mvvLvaValue('p');
+                    const int attackerValue = mvvLvaValue(_position.state[capture.from]);
+                    if (attackerValue > victimValue && !(capture.flags & IsPromotion)) {
+                        const int see = _position.see(capture);
+                        if (see < 0) {
+                            if (!_capturesOnly) {
+                                _badCaptures.add(capture);
+                                _badCaptures.scores[_badCaptures.count - 1] = see;
+                            }
+                            continue;
+                        }
+                    }
+                    _moves.moves[kept] = capture;
+                    _moves.scores[kept++] = victimValue * 10 - attackerValue;
+                }
+                _moves.count = kept;
+                _index = 0;
+                _stage = Captures;
+                break;
+            }
+
+            case Captures:
+                while (_index < _moves.count) {
+                    pickBest(_moves);
+                    move = _moves[_index++];
+                    if (!isHashMove(move)) {
+                        return true;
+                    }
+                }
+                _index = 0;
+                _stage = _capturesOnly ? Done : Killers;
+                break;
+
+            case Killers:
+                // killers are quiet moves that cut off at this ply in a sibling, often here too
+                while (_index < _killerCount) {
+                    move = _killers[_index++];
+                    if (_position.isLegal(move)) {
+                        return true;
+                    }
+                }
+                _stage = GenerateQuiets;
+                break;
+
+            case GenerateQuiets:
+                _position.generateQuietMoves(_moves);
+                for (int i = 0; i < _moves.count; i++) {
+                    _moves.scores[i] = _history[_moves[i].from][_moves[i].to];
+                }
+                _index = 0;
+                _stage = Quiets;
+                break;
+
+            case Quiets:
+                while (_index < _moves.count) {
+                    pickBest(_moves);
+                    move = _moves[_index++];
+                    if (!isHashMove(move) && !isKiller(move)) {
+                        return true;
+                    }
+                }
+                _index = 0;
+                _stage = BadCaptures;
+                break;
+
+            case BadCaptures:
+                while (_index < _badCaptures.count) {
+                    pickBest(_badCaptures);
+                    _lastSee = _badCaptures.scores[_index];
+                    move = _badCaptures[_index++];
+                    if (!isHashMove(move)) {
+                        return true;
+                    }
+                }
+                _lastSee = 0;
+                _stage = Done;
+                break;
+
+            case Done:
+                return false;
+        }
+    }
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "GameState.h"
+
+// hands out the moves of a node one at a time, best guess first, and only generates
+// what it gets to. the hash moves are tried before anything is generated, captures
+// before quiet moves, so a node that cuts off early never generates its quiet moves.
+// captures that lose material by static exchange evaluation come last
+class MovePicker
+{
+public:
+    // main search, pvMove and ttMove may be empty (from == to) and don't have to be legal
+    MovePicker(GameState& position, const BitMove& pvMove, const BitMove& ttMove,
+               const BitMove (&killers)[2], const int (&history)[64][64]);
+    // quiescence, captures and promotions only. losing captures are left out altogether
+    explicit MovePicker(GameState& position);
+
+    // false once every move was handed out
+    bool next(BitMove& move);
+    // static exchange value of the move next handed out if it was a losing capture, 0 otherwise
+    int lastSee() const { return _lastSee; }
+
+private:
+    enum Stage {
+        HashMoves,
+        GenerateCaptures,
+        Captures,
+        Killers,
+        GenerateQuiets,
+        Quiets,
+        BadCaptures,
+        Done
+    };
+
+    bool isHashMove(const BitMove& move) const;
+    bool isKiller(const BitMove& move) const;
+    // selection sort one step at a time, moves after a cutoff never get sorted
+    void pickBest(MoveList& moves);
+
+    GameState& _position;
+    Stage _stage;
+    bool _capturesOnly;
+    BitMove _hashMoves[2];
+    int _hashCount = 0;
+    BitMove _killers[2];
+    int _killerCount = 0;
+    const int (*_history)[64] = nullptr;
+    int _index = 0;
+    int _lastSee = 0;
+    MoveList _moves;
+    MoveList _badCaptures;      // scored by their exchange value
+};
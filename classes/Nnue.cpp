@@ -0,0 +1,249 @@
+#include "Nnue.h"
+#include "BoardEvaluator.h"
+#include "GameState.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define NNUE_X86
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+Nnue::~Nnue()
+{
+    unload();
+}
+
+bool Nnue::load(const char* path)
+{
+    unload();
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER size;
+    HANDLE mapping = nullptr;
+    void* view = nullptr;
+    if (GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    }
+    if (mapping) {
+        view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    }
+    if (!view) {
+        if (mapping) {
+            CloseHandle(mapping);
+        }
+        CloseHandle(file);
+        return false;
+    }
+    _file = file;
+    _mappingHandle = mapping;
+    _mapping = view;
+    _mappingSize = static_cast<size_t>(size.QuadPart);
+#else
+    const int file = open(path, O_RDONLY);
+    if (file < 0) {
+        return false;
+    }
+    struct stat info;
+    void* view = MAP_FAILED;
+    if (fstat(file, &info) == 0 && info.st_size > 0) {
+        view = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+    }
+    // the mapping keeps the file alive by itself
+    close(file);
+    if (view == MAP_FAILED) {
+        return false;
+    }
+    _mapping = view;
+    _mappingSize = static_cast<size_t>(info.st_size);
+#endif
+
+    const size_t expected = sizeof(Header) + sizeof(int16_t) * nnueHidden + sizeof(int16_t) * static_cast<size_t>(nnueInputs) * nnueHidden
+        + sizeof(int8_t) * 2 * nnueHidden + sizeof(int32_t);
+    const char* bytes = static_cast<const char*>(_mapping);
+    Header header;
+    if (_mappingSize != expected) {
+        std::cout << path << ": " << _mappingSize << " bytes, expected " << expected << std::endl;
+        unload();
+        return false;
+    }
+    std::memcpy(&header, bytes, sizeof(header));
+    if (std::memcmp(header.magic, "CHSNNUE1", 8) != 0 || header.inputs != nnueInputs || header.hidden != nnueHidden || header.outputScale <= 0) {
+        std::cout << path << ": not a " << nnueInputs << "x" << nnueHidden << " network" << std::endl;
+        unload();
+        return false;
+    }
+
+    const char* cursor = bytes + sizeof(Header);
+    _featureBiases = reinterpret_cast<const int16_t*>(cursor);
+    cursor += sizeof(int16_t) * nnueHidden;
+    _featureWeights = reinterpret_cast<const int16_t*>(cursor);
+    cursor += sizeof(int16_t) * static_cast<size_t>(nnueInputs) * nnueHidden;
+    _outputWeights = reinterpret_cast<const int8_t*>(cursor);
+    cursor += sizeof(int8_t) * 2 * nnueHidden;
+    std::memcpy(&_outputBias, cursor, sizeof(_outputBias));
+    _outputScale = header.outputScale;
+    return true;
+}
+
+void Nnue::unload()
+{
+    _featureBiases = nullptr;
+    _featureWeights = nullptr;
+    _outputWeights = nullptr;
+    if (!_mapping) {
+        return;
+    }
+#if defined(_WIN32)
+    UnmapViewOfFile(_mapping);
+    CloseHandle(static_cast<HANDLE>(_mappingHandle));
+    CloseHandle(static_cast<HANDLE>(_file));
+    _mappingHandle = nullptr;
+    _file = nullptr;
+#else
+    munmap(_mapping, _mappingSize);
+#endif
+    _mapping = nullptr;
+    _mappingSize = 0;
+}
+
+int Nnue::featureIndex(int perspective, int kingSquare, unsigned char piece, int square)
+{
+    int type;
+    switch (piece | 0x20) {  // lower case
+        case 'p': type = 0; break;
+        case 'n': type = 1; break;
+        case 'b': type = 2; break;
+        case 'r': type = 3; break;
+        case 'q': type = 4; break;
+        default: return -1;
+    }
+    const bool white = piece < 'a';
+    const bool own = white == (perspective == 0);
+    // black sees the board upside down, so both sides learn the same weights
+    if (perspective == 1) {
+        kingSquare ^= 56;
+        square ^= 56;
+    }
+    return (kingSquare * 10 + type * 2 + (own ? 0 : 1)) * 64 + square;
+}
+
+void Nnue::refresh(const char* state, int perspective, NnueAccumulator& accumulator) const
+{
+    const unsigned char king = perspective == 0 ? 'K' : 'k';
+    const char* kingAt = static_cast<const char*>(std::memchr(state, king, 64));
+    const int kingSquare = kingAt ? static_cast<int>(kingAt - state) : 0;
+
+    int16_t* values = accumulator.values[perspective];
+    std::copy(_featureBiases, _featureBiases + nnueHidden, values);
+    for (int square = 0; square < 64; square++) {
+        const int feature = featureIndex(perspective, kingSquare, state[square], square);
+        if (feature < 0) {
+            continue;
+        }
+        const int16_t* weights = _featureWeights + static_cast<size_t>(feature) * nnueHidden;
+        for (int i = 0; i < nnueHidden; i++) {
+            values[i] += weights[i];
+        }
+    }
+}
+
+// plain loops over int16, the compiler vectorizes them
+void Nnue::update(const NnueAccumulator& parent, NnueAccumulator& child, int perspective,
+                  const int* removed, int removedCount, const int* added, int addedCount) const
+{
+    int16_t* values = child.values[perspective];
+    std::copy(parent.values[perspective], parent.values[perspective] + nnueHidden, values);
+    for (int r = 0; r < removedCount; r++) {
+        const int16_t* weights = _featureWeights + static_cast<size_t>(removed[r]) * nnueHidden;
+        for (int i = 0; i < nnueHidden; i++) {
+            values[i] -= weights[i];
+        }
+    }
+    for (int a = 0; a < addedCount; a++) {
+        const int16_t* weights = _featureWeights + static_cast<size_t>(added[a]) * nnueHidden;
+        for (int i = 0; i < nnueHidden; i++) {
+            values[i] += weights[i];
+        }
+    }
+}
+
+// clipped relu to 0..127 then the int8 output weights, 2 * 127 * 127 fits the int16 pairs
+// maddubs makes so both versions give the same sum
+static int outputScalar(const int16_t* us, const int16_t* them, const int8_t* weights)
+{
+    int sum = 0;
+    for (int i = 0; i < nnueHidden; i++) {
+        sum += std::clamp<int>(us[i], 0, 127) * weights[i];
+        sum += std::clamp<int>(them[i], 0, 127) * weights[nnueHidden + i];
+    }
+    return sum;
+}
+
+#if defined(NNUE_X86)
+TARGET_AVX2 static int outputAVX2(const int16_t* us, const int16_t* them, const int8_t* weights)
+{
+    const __m256i ones = _mm256_set1_epi16(1);
+    const __m256i limit = _mm256_set1_epi8(127);
+    __m256i sum = _mm256_setzero_si256();
+    for (const int16_t* half : { us, them }) {
+        for (int i = 0; i < nnueHidden; i += 32) {
+            const __m256i low = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(half + i));
+            const __m256i high = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(half + i + 16));
+            // packus saturates to 0..255 and interleaves the 128 bit lanes, the permute puts them back in order
+            __m256i clipped = _mm256_min_epu8(_mm256_packus_epi16(low, high), limit);
+            clipped = _mm256_permute4x64_epi64(clipped, 0xD8);
+            const __m256i w = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(weights + i));
+            sum = _mm256_add_epi32(sum, _mm256_madd_epi16(_mm256_maddubs_epi16(clipped, w), ones));
+        }
+        weights += nnueHidden;
+    }
+    __m128i total = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    total = _mm_add_epi32(total, _mm_shuffle_epi32(total, _MM_SHUFFLE(1, 0, 3, 2)));
+    total = _mm_add_epi32(total, _mm_shuffle_epi32(total, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(total);
+}
+#endif
+
+int Nnue::outputSum(const int16_t* us, const int16_t* them, const int8_t* weights,
+                    BoardEvaluator::Implementation implementation)
+{
+#if defined(NNUE_X86)
+    if (implementation == BoardEvaluator::AVX2 && BoardEvaluator::isSupported(BoardEvaluator::AVX2)) {
+        return outputAVX2(us, them, weights);
+    }
+#endif
+    return outputScalar(us, them, weights);
+}
+
+int Nnue::evaluate(const NnueAccumulator& accumulator, char sideToMove) const
+{
+    const int16_t* us = accumulator.values[sideToMove == WHITE ? 0 : 1];
+    const int16_t* them = accumulator.values[sideToMove == WHITE ? 1 : 0];
+#if defined(NNUE_X86)
+    static const bool avx2 = BoardEvaluator::isSupported(BoardEvaluator::AVX2);
+    const int sum = avx2 ? outputAVX2(us, them, _outputWeights) : outputScalar(us, them, _outputWeights);
+#else
+    const int sum = outputScalar(us, them, _outputWeights);
+#endif
+    return (sum + _outputBias) / _outputScale;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "BoardEvaluator.h"
+
+// efficiently updatable neural network evaluation, optional in place of the piece square tables.
+// the inputs are HalfKP features, one per (own king square, non king piece, square) from each
+// side's point of view. the first layer's sums live in an accumulator that pushMove updates
+// for the few pieces that moved, only a king move recomputes that side's half
+constexpr int nnueInputs = 64 * 10 * 64;
+constexpr int nnueHidden = 128;
+
+struct alignas(32) NnueAccumulator {
+    int16_t values[2][nnueHidden];    // [0] white's point of view, [1] black's
+};
+
+class Nnue
+{
+public:
+    Nnue() = default;
+    ~Nnue();
+    Nnue(const Nnue&) = delete;
+    Nnue& operator=(const Nnue&) = delete;
+
+    // maps the weights file into memory, false if it is missing or doesn't match this network
+    bool load(const char* path);
+    void unload();
+    bool loaded() const { return _featureWeights != nullptr; }
+
+    // perspective 0 is white, 1 is black. state is the 64 squares, a1 first
+    void refresh(const char* state, int perspective, NnueAccumulator& accumulator) const;
+    // copies parent's half into child's with the listed features taken out and put in
+    void update(const NnueAccumulator& parent, NnueAccumulator& child, int perspective,
+                const int* removed, int removedCount, const int* added, int addedCount) const;
+    // centipawns for the side to move
+    int evaluate(const NnueAccumulator& accumulator, char sideToMove) const;
+    // the output layer's sum over both halves before bias and scale, scalar where the cpu can't
+    // run the given version. static so the versions can be compared without a weights file
+    static int outputSum(const int16_t* us, const int16_t* them, const int8_t* weights,
+                         BoardEvaluator::Implementation implementation);
+
+    // -1 for kings and empty squares, they aren't features
+    static int featureIndex(int perspective, int kingSquare, unsigned char piece, int square);
+
+private:
+    // file layout after a 32 byte header: int16 biases[hidden], int16 weights[inputs][hidden],
+    // int8 output weights[2 * hidden] (side to move first), int32 output bias
+    struct Header {
+        char magic[8];          // "CHSNNUE1"
+        uint32_t inputs;
+        uint32_t hidden;
+        int32_t outputScale;    // the output layer's sum is divided by this
+        uint32_t reserved[3];
+    };
+    static_assert(sizeof(Header) == 32, "weights file header is 32 bytes");
+
+    const int16_t* _featureBiases = nullptr;
+    const int16_t* _featureWeights = nullptr;
+    const int8_t* _outputWeights = nullptr;
+    int32_t _outputBias = 0;
+    int32_t _outputScale = 1;
+
+    void* _mapping = nullptr;
+    size_t _mappingSize = 0;
+#if defined(_WIN32)
+    void* _file = nullptr;
+    void* _mappingHandle = nullptr;
+#endif
+};
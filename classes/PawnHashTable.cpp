@@ -0,0 +1,22 @@
+#include "PawnHashTable.h"
+
+PawnHashTable::PawnHashTable(size_t entries)
+{
+    size_t size = 1;
+    while (size * 2 <= entries) {
+        size *= 2;
+    }
+    _entries.reset(new PawnEntry[size]);
+    _mask = size - 1;
+    clear();
+}
+
+void PawnHashTable::clear()
+{
+    // an empty entry has key zero and no score, which is right for the one position
+    // that has that key, no pawns at all
+    for (size_t i = 0; i <= _mask; i++) {
+        _entries[i] = PawnEntry();
+    }
+    resetStats();
+}
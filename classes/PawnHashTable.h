@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+
+// what the pawn structure is worth, it only depends on where the pawns are
+struct PawnEntry {
+    uint64_t key = 0;
+    uint64_t passed[2] = {};    // passed pawns, [0] white's and [1] black's
+    int score = 0;              // packed passed, doubled and isolated pawn terms, white minus black
+};
+
+// every search thread has its own, so there is no locking. pawns rarely move
+// compared to the other pieces, nearly every leaf finds its structure here
+class PawnHashTable
+{
+public:
+    // size is rounded down to a power of two number of entries
+    explicit PawnHashTable(size_t entries = 1 << 14);
+
+    void clear();
+    // the entry for key. on a miss it is the slot to overwrite and hit comes back false
+    PawnEntry& probe(uint64_t key, bool& hit) {
+        PawnEntry& entry = _entries[key & _mask];
+        hit = entry.key == key;
+        _probes++;
+        _hits += hit;
+        return entry;
+    }
+
+    long long probes() const { return _probes; }
+    long long hits() const { return _hits; }
+    void resetStats() { _probes = 0; _hits = 0; }
+
+private:
+    std::unique_ptr<PawnEntry[]> _entries;
+    size_t _mask = 0;
+    long long _probes = 0;
+    long long _hits = 0;
+};
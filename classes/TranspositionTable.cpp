@@ -0,0 +1,133 @@
+#include "TranspositionTable.h"
+#include <algorithm>
+
+constexpr int scoreBits = 21;
+constexpr int scoreBias = 1 << (scoreBits - 1);
+
+void TranspositionTable::resize(size_t megabytes)
+{
+    size_t buckets = 1;
+    while (buckets * 2 * sizeof(TTBucket) <= megabytes * 1024 * 1024) {
+        buckets *= 2;
+    }
+    _buckets.reset(new TTBucket[buckets]);
+    _numBuckets = buckets;
+    _mask = buckets - 1;
+    clear();
+}
+
+void TranspositionTable::clear()
+{
+    for (size_t i = 0; i < _numBuckets; i++) {
+        for (TTSlot& slot : _buckets[i].slots) {
+            slot.keyXorData.store(0, std::memory_order_relaxed);
+            slot.data.store(0, std::memory_order_relaxed);
+        }
+    }
+    _generation = 0;
+}
+
+uint64_t TranspositionTable::pack(int depth, int score, TTBound bound, const BitMove& move, uint8_t generation)
+{
+    const uint64_t biasedScore = static_cast<uint64_t>(std::clamp(score, -scoreBias, scoreBias - 1) + scoreBias);
+    return biasedScore
+        | static_cast<uint64_t>(move.from & 63) << 21
+        | static_cast<uint64_t>(move.to & 63) << 27
+        | static_cast<uint64_t>(move.piece & 7) << 33
+        | static_cast<uint64_t>(move.flags & 31) << 36
+        | static_cast<uint64_t>(std::clamp(depth, 0, 127)) << 41
+        | static_cast<uint64_t>(bound) << 48
+        | static_cast<uint64_t>(generation & 63) << 50;
+}
+
+TTEntry TranspositionTable::unpack(uint64_t data)
+{
+    TTEntry entry;
+    entry.score = static_cast<int>(data & ((1ULL << scoreBits) - 1)) - scoreBias;
+    entry.move.from = (data >> 21) & 63;
+    entry.move.to = (data >> 27) & 63;
+    entry.move.piece = (data >> 33) & 7;
+    entry.move.flags = (data >> 36) & 31;
+    entry.depth = depthOf(data);
+    entry.bound = boundOf(data);
+    return entry;
+}
+
+bool TranspositionTable::probe(uint64_t key, TTEntry& entry) const
+{
+    if (!_numBuckets) {
+        return false;
+    }
+    const TTBucket& bucket = bucketFor(key);
+    for (const TTSlot& slot : bucket.slots) {
+        const uint64_t data = slot.data.load(std::memory_order_relaxed);
+        if ((slot.keyXorData.load(std::memory_order_relaxed) ^ data) == key && boundOf(data) != TTNone) {
+            entry = unpack(data);
+            return true;
+        }
+    }
+    return false;
+}
+
+void TranspositionTable::store(uint64_t key, int depth, int score, TTBound bound, const BitMove& move)
+{
+    if (!_numBuckets) {
+        return;
+    }
+    TTBucket& bucket = bucketFor(key);
+
+    // same position already in the bucket? otherwise replace the shallowest, oldest entry
+    TTSlot* replace = &bucket.slots[0];
+    uint64_t replaceData = 0;
+    bool samePosition = false;
+    int replaceWorth = 1 << 30;
+    for (TTSlot& slot : bucket.slots) {
+        const uint64_t data = slot.data.load(std::memory_order_relaxed);
+        if (boundOf(data) == TTNone) {
+            replace = &slot;
+            replaceData = data;
+            break;
+        }
+        if ((slot.keyXorData.load(std::memory_order_relaxed) ^ data) == key) {
+            replace = &slot;
+            replaceData = data;
+            samePosition = true;
+            break;
+        }
+        const int age = (_generation - generationOf(data)) & 63;
+        const int worth = depthOf(data) - 8 * age;
+        if (worth < replaceWorth) {
+            replace = &slot;
+            replaceData = data;
+            replaceWorth = worth;
+        }
+    }
+
+    // don't let a shallow bound from this search wipe out a deeper result
+    if (samePosition && bound != TTExact && depth < depthOf(replaceData) && generationOf(replaceData) == _generation) {
+        return;
+    }
+    // an all-node has no best move, keep the one we had for this position
+    BitMove bestMove = move;
+    if (samePosition && move.from == move.to) {
+        bestMove = unpack(replaceData).move;
+    }
+    const uint64_t data = pack(depth, score, bound, bestMove, _generation);
+    replace->keyXorData.store(key ^ data, std::memory_order_relaxed);
+    replace->data.store(data, std::memory_order_relaxed);
+}
+
+int TranspositionTable::hashfull() const
+{
+    const size_t samples = std::min<size_t>(_numBuckets, 250);
+    int used = 0;
+    for (size_t i = 0; i < samples; i++) {
+        for (const TTSlot& slot : _buckets[i].slots) {
+            const uint64_t data = slot.data.load(std::memory_order_relaxed);
+            if (boundOf(data) != TTNone && generationOf(data) == _generation) {
+                used++;
+            }
+        }
+    }
+    return samples ? static_cast<int>(used * 1000 / (samples * TTBucket::numEntries)) : 0;
+}
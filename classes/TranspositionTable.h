@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include "GameState.h"
+
+enum TTBound : uint8_t {
+    TTNone,
+    TTUpper,    // failed low, score is at most this
+    TTLower,    // failed high, score is at least this
+    TTExact
+};
+
+// what a probe hands back, unpacked from the shared slot
+struct TTEntry {
+    int score = 0;
+    BitMove move;
+    int depth = 0;
+    TTBound bound = TTNone;
+};
+
+// 16 bytes, four of them share a cache line. every search thread reads and writes
+// these without locking, the key is stored xor'd with the data so a slot that two
+// threads wrote at the same time no longer matches either key and is ignored
+struct TTSlot {
+    std::atomic<uint64_t> keyXorData{0};
+    std::atomic<uint64_t> data{0};
+};
+
+struct alignas(64) TTBucket {
+    static constexpr int numEntries = 4;
+    TTSlot slots[numEntries];
+};
+
+class TranspositionTable
+{
+public:
+    TranspositionTable() : _generation(0) { }
+
+    // size is rounded down to a power of two number of buckets
+    void resize(size_t megabytes);
+    void clear();
+    // call once per search so older entries get replaced first
+    void newSearch() { _generation = (_generation + 1) & 63; }
+
+    // fills entry and returns true if the position is in the table
+    bool probe(uint64_t key, TTEntry& entry) const;
+    void store(uint64_t key, int depth, int score, TTBound bound, const BitMove& move);
+
+    // permill of sampled entries written during the current search
+    int hashfull() const;
+
+private:
+    // data layout, low bit first: score 21, from 6, to 6, piece 3, move flags 5, depth 7, bound 2, generation 6
+    static uint64_t pack(int depth, int score, TTBound bound, const BitMove& move, uint8_t generation);
+    static TTEntry unpack(uint64_t data);
+    static TTBound boundOf(uint64_t data) { return static_cast<TTBound>((data >> 48) & 3); }
+    static int depthOf(uint64_t data) { return static_cast<int>((data >> 41) & 127); }
+    static uint8_t generationOf(uint64_t data) { return static_cast<uint8_t>(data >> 50); }
+
+    TTBucket& bucketFor(uint64_t key) { return _buckets[key & _mask]; }
+    const TTBucket& bucketFor(uint64_t key) const { return _buckets[key & _mask]; }
+
+    std::unique_ptr<TTBucket[]> _buckets;
+    size_t _numBuckets = 0;
+    uint64_t _mask = 0;
+    uint8_t _generation;
+};
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <atomic>
+
+// single producer / single consumer handoff that never blocks either side.
+// the writer fills back() and publishes it, the reader picks up the newest
+// published value with update() and reads it from front()
+template <typename T>
+class TripleBuffer
+{
+public:
+    // writer side
+    T& back() { return _slots[_back]; }
+    void publish() {
+        _back = _middle.exchange(_back | dirtyBit, std::memory_order_acq_rel) & indexMask;
+    }
+
+    // reader side, returns true when a newer value was picked up
+    bool update() {
+        if (!(_middle.load(std::memory_order_relaxed) & dirtyBit)) {
+            return false;
+        }
+        _front = _middle.exchange(_front, std::memory_order_acq_rel) & indexMask;
+        return true;
+    }
+    const T& front() const { return _slots[_front]; }
+
+private:
+    static constexpr unsigned dirtyBit = 4;
+    static constexpr unsigned indexMask = 3;
+
+    T _slots[3];
+    std::atomic<unsigned> _middle{1};
+    unsigned _back = 0;
+    unsigned _front = 2;
+};
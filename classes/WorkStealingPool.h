@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+
+// one deque of work items per thread. the owner pushes and pops at the back,
+// idle threads steal from the front of everyone else's, where the oldest work is.
+// the accept callback lets a caller only take items it is allowed to run
+template <typename T>
+class WorkStealingPool
+{
+public:
+    void resize(size_t workers) {
+        _deques.reset(new WorkDeque[workers]);
+        _workers = workers;
+    }
+
+    void push(size_t worker, const T& item, int count = 1) {
+        std::lock_guard<std::mutex> lock(_deques[worker].lock);
+        for (int i = 0; i < count; i++) {
+            _deques[worker].items.push_back(item);
+        }
+    }
+
+    // newest item of our own deque
+    template <typename Accept>
+    bool pop(size_t worker, T& item, Accept accept) {
+        WorkDeque& deque = _deques[worker];
+        std::lock_guard<std::mutex> lock(deque.lock);
+        if (deque.items.empty() || !accept(deque.items.back())) {
+            return false;
+        }
+        item = deque.items.back();
+        deque.items.pop_back();
+        return true;
+    }
+
+    // oldest acceptable item of any other deque, starting with the next worker over
+    template <typename Accept>
+    bool steal(size_t thief, T& item, Accept accept) {
+        for (size_t i = 1; i < _workers; i++) {
+            WorkDeque& deque = _deques[(thief + i) % _workers];
+            std::lock_guard<std::mutex> lock(deque.lock);
+            for (auto it = deque.items.begin(); it != deque.items.end(); ++it) {
+                if (accept(*it)) {
+                    item = *it;
+                    deque.items.erase(it);
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+private:
+    struct WorkDeque {
+        std::mutex lock;
+        std::deque<T> items;
+    };
+
+    std::unique_ptr<WorkDeque[]> _deques;
+    size_t _workers = 0;
+};
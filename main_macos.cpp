@@ -11,6 +11,8 @@
 #include "imgui/imgui_impl_glfw.h"
 #include "imgui/imgui_impl_opengl3.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #define GL_SILENCE_DEPRECATION
 #if defined(IMGUI_IMPL_OPENGL_ES2)
 #include <GLES2/gl2.h>
@@ -36,8 +38,15 @@ static void glfw_error_callback(int error, const char* description)
 }
 
 // Main code
-int main(int, char**)
+int main(int argc, char** argv)
 {
+    if (argc > 1 && strcmp(argv[1], "bench") == 0)
+        return ClassGame::RunBench(argc > 2 ? atoi(argv[2]) : 8);
+    if (argc > 1 && strcmp(argv[1], "perft") == 0)
+        return ClassGame::RunPerft(argc > 2 ? atoi(argv[2]) : 4);
+    if (argc > 1 && strcmp(argv[1], "evalbench") == 0)
+        return ClassGame::RunEvalBench();
+
     glfwSetErrorCallback(glfw_error_callback);
     if (!glfwInit())
         return 1;
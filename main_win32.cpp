@@ -11,6 +11,8 @@
 #include "imgui/imgui_impl_dx11.h"
 #include <d3d11.h>
 #include <tchar.h>
+#include <stdlib.h>
+#include <string.h>
 #include "Application.h"
 
 // Data
@@ -29,8 +31,15 @@ void CleanupRenderTarget();
 LRESULT WINAPI WndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam);
 
 // Main code
-int main(int, char**)
+int main(int argc, char** argv)
 {
+    if (argc > 1 && strcmp(argv[1], "bench") == 0)
+        return ClassGame::RunBench(argc > 2 ? atoi(argv[2]) : 8);
+    if (argc > 1 && strcmp(argv[1], "perft") == 0)
+        return ClassGame::RunPerft(argc > 2 ? atoi(argv[2]) : 4);
+    if (argc > 1 && strcmp(argv[1], "evalbench") == 0)
+        return ClassGame::RunEvalBench();
+
     // Make process DPI aware and obtain main monitor scale
     ImGui_ImplWin32_EnableDpiAwareness();
     float main_scale = ImGui_ImplWin32_GetDpiScaleForMonitor(::MonitorFromPoint(POINT{ 0, 0 }, MONITOR_DEFAULTTOPRIMARY));